@@ -6,6 +6,7 @@
 /// @author Bernhard Egger <bernhard@csap.snu.ac.kr>
 /// @section changelog Change Log
 /// 2020/10/04 Bernhard Egger created
+/// 2026/10/14 hash index and order-statistic tree, pooled nodes
 ///
 /// @section license_section License
 /// Copyright (c) 2020-2023, Computer Systems and Platforms Laboratory, SNU
@@ -31,12 +32,231 @@
 /// DAMAGE.
 //--------------------------------------------------------------------------------------------------
 
+// Block list
+// ==========
+// Every block is kept in three structures:
+// - a doubly-linked list ordered by ptr (Block.prev/next) between the sentinels head and tail:
+//   first_block(), next_block(), and iterate_blocks() take O(1) per block
+// - an open-addressing hash table (linear probing) mapping ptr to its Block: find_block() in O(1)
+// - a treap ordered by ptr with subtree sizes: the list position of new blocks and
+//   find_block_by_index() in O(log n)
+//
+// Blocks with equal ptr are kept in insertion order (the treap orders them by a sequence number);
+// the hash table refers to the first of them, which is the one find_block() and delete_block()
+// operate on.
+//
+// Block nodes are allocated from chunks of NODES_PER_CHUNK nodes and recycled through a free
+// list; chunks are only released by free_blocklist().
+
 #include <assert.h>
+#include <stdint.h>
+#include <string.h>
 #include "blocklist.h"
 
+#define NODES_PER_CHUNK 1024      ///< number of nodes allocated at once
+#define HASH_MINSIZE    1024      ///< initial number of hash table slots
+
+/// @brief block with its treap links
+typedef struct __node {
+  Block           b;              ///< block (must be the first member)
+  struct __node   *left, *right;  ///< treap children; left links the free list of the pool
+  size_t          count;          ///< number of nodes in subtree
+  uint64_t        seq;            ///< insertion sequence number
+  uint32_t        prio;           ///< treap priority
+} Node;
+
+/// @brief chunk of nodes
+typedef struct __chunk {
+  struct __chunk  *next;          ///< next chunk
+  Node            node[NODES_PER_CHUNK]; ///< nodes
+} Chunk;
+
 Block *head = NULL;
 Block *tail = NULL;
 
+static Block    sentinel[2];      ///< head & tail sentinels
+static Node     *root = NULL;     ///< treap root
+static Chunk    *chunks = NULL;   ///< node pool chunks
+static Node     *free_nodes = NULL; ///< unused nodes
+static Block    **hash = NULL;    ///< hash table (NULL: empty slot)
+static size_t   hash_mask = 0;    ///< number of hash table slots - 1
+static size_t   hash_used = 0;    ///< number of used hash table slots
+static size_t   nblocks = 0;      ///< number of blocks
+static uint64_t next_seq = 0;     ///< next insertion sequence number
+static uint32_t prio_state = 2463534242u; ///< treap priority generator state
+
+
+/// @brief get a node from the pool
+/// @retval Node* cleared node
+/// @retval NULL if out of memory
+static Node* node_alloc(void)
+{
+  if (free_nodes == NULL) {
+    Chunk *c = malloc(sizeof(Chunk));
+    if (c == NULL) return NULL;
+
+    c->next = chunks;
+    chunks = c;
+    for (size_t i=0; i<NODES_PER_CHUNK; i++) {
+      c->node[i].left = free_nodes;
+      free_nodes = &c->node[i];
+    }
+  }
+
+  Node *n = free_nodes;
+  free_nodes = n->left;
+  memset(n, 0, sizeof(*n));
+
+  return n;
+}
+
+/// @brief return node @a n to the pool
+static void node_free(Node *n)
+{
+  n->left = free_nodes;
+  free_nodes = n;
+}
+
+
+/// @brief get the home slot of @a ptr in the hash table
+static size_t hash_home(const void *ptr)
+{
+  return (((uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15UL >> 16) & hash_mask;
+}
+
+/// @brief find the slot holding @a ptr, or the empty slot where it would be inserted
+static size_t hash_find(const void *ptr)
+{
+  size_t i = hash_home(ptr);
+  while ((hash[i] != NULL) && (hash[i]->ptr != ptr)) i = (i + 1) & hash_mask;
+  return i;
+}
+
+/// @brief double the size of the hash table
+/// @retval 1 on success
+/// @retval 0 if out of memory
+static int hash_grow(void)
+{
+  Block **old = hash;
+  size_t oldsize = hash_mask + 1;
+
+  hash = calloc(2*oldsize, sizeof(Block*));
+  if (hash == NULL) {
+    hash = old;
+    return 0;
+  }
+  hash_mask = 2*oldsize - 1;
+
+  for (size_t i=0; i<oldsize; i++) {
+    if (old[i] != NULL) hash[hash_find(old[i]->ptr)] = old[i];
+  }
+  free(old);
+
+  return 1;
+}
+
+/// @brief clear slot @a i and move later entries of the probe sequence back
+static void hash_remove(size_t i)
+{
+  hash[i] = NULL;
+  hash_used--;
+
+  for (size_t j = (i + 1) & hash_mask; hash[j] != NULL; j = (j + 1) & hash_mask) {
+    size_t k = hash_home(hash[j]->ptr);
+    // the entry at j may move to i unless its home slot k lies cyclically in (i, j]
+    if ((i <= j) ? ((k <= i) || (k > j)) : ((k <= i) && (k > j))) {
+      hash[i] = hash[j];
+      hash[j] = NULL;
+      i = j;
+    }
+  }
+}
+
+
+/// @brief number of nodes in treap @a t
+static size_t count(const Node *t)
+{
+  return t != NULL ? t->count : 0;
+}
+
+/// @brief treap order: by ptr, then by insertion
+static int node_less(const Node *a, const Node *b)
+{
+  return (a->b.ptr < b->b.ptr) || ((a->b.ptr == b->b.ptr) && (a->seq < b->seq));
+}
+
+/// @brief rotate treap @a t right
+static Node* rotate_right(Node *t)
+{
+  Node *l = t->left;
+  t->left = l->right;
+  l->right = t;
+  l->count = t->count;
+  t->count = 1 + count(t->left) + count(t->right);
+  return l;
+}
+
+/// @brief rotate treap @a t left
+static Node* rotate_left(Node *t)
+{
+  Node *r = t->right;
+  t->right = r->left;
+  r->left = t;
+  r->count = t->count;
+  t->count = 1 + count(t->left) + count(t->right);
+  return r;
+}
+
+/// @brief insert node @a n into treap @a t
+/// @retval Node* new root of @a t
+static Node* treap_insert(Node *t, Node *n)
+{
+  if (t == NULL) return n;
+
+  t->count++;
+  if (node_less(n, t)) {
+    t->left = treap_insert(t->left, n);
+    if (t->left->prio > t->prio) t = rotate_right(t);
+  } else {
+    t->right = treap_insert(t->right, n);
+    if (t->right->prio > t->prio) t = rotate_left(t);
+  }
+
+  return t;
+}
+
+/// @brief merge treaps @a a and @a b where all nodes of @a a precede those of @a b
+/// @retval Node* root of merged treap
+static Node* treap_merge(Node *a, Node *b)
+{
+  if (a == NULL) return b;
+  if (b == NULL) return a;
+
+  if (a->prio > b->prio) {
+    a->count += b->count;
+    a->right = treap_merge(a->right, b);
+    return a;
+  } else {
+    b->count += a->count;
+    b->left = treap_merge(a, b->left);
+    return b;
+  }
+}
+
+/// @brief remove node @a n from treap @a t (which must contain @a n)
+/// @retval Node* new root of @a t
+static Node* treap_remove(Node *t, Node *n)
+{
+  if (t == n) return treap_merge(t->left, t->right);
+
+  t->count--;
+  if (node_less(n, t)) t->left = treap_remove(t->left, n);
+  else t->right = treap_remove(t->right, n);
+
+  return t;
+}
+
+
 void init_blocklist(void)
 {
   if (head != NULL) free_blocklist();
@@ -44,8 +264,9 @@ void init_blocklist(void)
   //
   // create head & tail sentinels
   //
-  head = calloc(1, sizeof(Block));
-  tail = calloc(1, sizeof(Block));
+  head = &sentinel[0];
+  tail = &sentinel[1];
+  memset(sentinel, 0, sizeof(sentinel));
 
   head->next = tail;
   tail->prev = head;
@@ -59,17 +280,26 @@ void init_blocklist(void)
   // always holds.
   head->ptr  = NULL;
   tail->ptr  = (void*)-1;
+
+  hash = calloc(HASH_MINSIZE, sizeof(Block*));
+  hash_mask = HASH_MINSIZE - 1;
+  assert(hash != NULL);
 }
 
 void free_blocklist(void)
 {
-  Block *b = head;
-  while (b != NULL) {
-    Block *next = b->next;
-    free(b);
-    b = next;
+  while (chunks != NULL) {
+    Chunk *next = chunks->next;
+    free(chunks);
+    chunks = next;
   }
+  free(hash);
+
   head = tail = NULL;
+  root = NULL;
+  free_nodes = NULL;
+  hash = NULL;
+  hash_mask = hash_used = nblocks = 0;
 }
 
 Block* insert_block(void *ptr, size_t size, int flags)
@@ -77,21 +307,47 @@ Block* insert_block(void *ptr, size_t size, int flags)
   assert(head != NULL);
   assert((ptr != NULL) && (ptr != (void*)-1));
 
-  Block *b = calloc(1, sizeof(Block));
-  if (b != NULL) {
-    b->ptr = ptr;
-    b->size = size;
-    b->flags = flags;
+  if ((2*(hash_used + 1) > hash_mask + 1) && !hash_grow()) return NULL;
+
+  Node *n = node_alloc();
+  if (n == NULL) return NULL;
+
+  Block *b = &n->b;
+  b->ptr = ptr;
+  b->size = size;
+  b->flags = flags;
+  n->count = 1;
+  n->seq = next_seq++;
+  prio_state ^= prio_state << 13;
+  prio_state ^= prio_state >> 17;
+  prio_state ^= prio_state << 5;
+  n->prio = prio_state;
+
+  // the successor of the new block in the list is the smallest larger node in the treap
+  Block *s = tail;
+  for (Node *t = root; t != NULL; ) {
+    if (node_less(n, t)) {
+      s = &t->b;
+      t = t->left;
+    } else {
+      t = t->right;
+    }
+  }
 
-    Block *s = head;
-    while (s->ptr <= ptr) s = s->next;
+  b->next = s;
+  b->prev = s->prev;
+  s->prev = b;
+  b->prev->next = b;
 
-    b->next = s;
-    b->prev = s->prev;
-    s->prev = b;
-    b->prev->next = b;
+  size_t i = hash_find(ptr);
+  if (hash[i] == NULL) {
+    hash[i] = b;
+    hash_used++;
   }
 
+  root = treap_insert(root, n);
+  nblocks++;
+
   return b;
 }
 
@@ -100,23 +356,26 @@ Block* find_block(void *ptr)
   assert(head != NULL);
   assert((ptr != NULL) && (ptr != (void*)-1));
 
-  Block *b = head;
-  while (b->ptr < ptr) b = b->next;
-
-  return b->ptr == ptr ? b : NULL;
+  return hash[hash_find(ptr)];
 }
 
 Block* find_block_by_index(size_t idx)
 {
   assert(head != NULL);
 
-  Block *b = head->next;
-  while ((b != tail) && (idx > 0)) {
-    b = b->next;
-    idx--;
+  Node *t = root;
+  while (t != NULL) {
+    size_t l = count(t->left);
+    if (idx == l) break;
+    if (idx < l) {
+      t = t->left;
+    } else {
+      idx -= l + 1;
+      t = t->right;
+    }
   }
 
-  return b != tail ? b : NULL;
+  return t != NULL ? &t->b : NULL;
 }
 
 int delete_block(void *ptr)
@@ -124,11 +383,19 @@ int delete_block(void *ptr)
   assert(head != NULL);
   assert((ptr != NULL) && (ptr != (void*)-1));
 
-  Block *b = find_block(ptr);
+  size_t i = hash_find(ptr);
+  Block *b = hash[i];
   if (b != NULL) {
+    // duplicates follow in the list
+    if (b->next->ptr == ptr) hash[i] = b->next;
+    else hash_remove(i);
+
     b->prev->next = b->next;
     b->next->prev = b->prev;
-    free(b);
+
+    root = treap_remove(root, (Node*)b);
+    node_free((Node*)b);
+    nblocks--;
   }
 
   return b != NULL;
@@ -136,7 +403,9 @@ int delete_block(void *ptr)
 
 const Block* first_block(void)
 {
-  return find_block_by_index(0);
+  assert(head != NULL);
+
+  return head->next != tail ? head->next : NULL;
 }
 
 const Block* next_block(const Block *b)
@@ -170,22 +439,13 @@ size_t num_blocks(void)
 {
   assert(head != NULL);
 
-  size_t res = 0;
-  Block *b = head->next;
-
-  while (b != tail) {
-    b = b->next;
-    res++;
-  }
-
-  return res;
+  return nblocks;
 }
 
 Block** get_block_array(void)
 {
   assert(head != NULL);
 
-  size_t nblocks = num_blocks();
   Block **res = (Block**)calloc(nblocks+1, sizeof(Block*));
 
   if (res != NULL) {
@@ -61,38 +61,126 @@
 // start of the heap and the brk pointer both point to the beginning of the heap
 // (i.e., to ds_start + PAGESIZE).
 //
+// ds_allocate() faults in the entire data segment up front. ds_allocate_ex() can instead
+// - populate pages lazily on first access (DS_LAZY)
+// - back the segment with transparent (DS_HUGEPAGE) or explicit (DS_HUGETLB) huge pages. With
+//   explicit huge pages, PAGESIZE is the huge page size and all protection is huge-page granular.
+// - lock the segment in RAM (DS_MLOCK)
+// Options the system cannot honor are reported as warnings and otherwise ignored.
+//
 // The heap size can be adjusted by calling ds_sbrk(). The memory protection flags are set 
-// automatically whenever the ds_heap_brk pointer is adjusted.
+// automatically whenever the ds_heap_brk pointer is adjusted. Each (sub-)segment remembers the
+// page-aligned end of its read/write area, so only the pages between the old and the new brk
+// need to be re-protected. If mprotect() is turned off, the entire heap is read/write. When the
+// brk is lowered, pages that lie entirely above the new brk are released to the system; they read
+// as zero when the brk is raised again.
 //
 // ds_heap_stat() can be used to retrieve information about the heap area.
 //
+// Sub-segments:
+// -------------
+// A clean data segment can be partitioned into up to DS_MAXSEG independent sub-segments by
+// calling ds_partition(). Each sub-segment is page-aligned, has its own brk pointer, and is
+// followed by one PROT_NONE guard page. ds_sbrk_seg() and ds_heap_stat_seg() operate on a
+// single sub-segment; ds_sbrk() and ds_heap_stat() operate on sub-segment 0. Sub-segments can
+// be grown concurrently from different threads; a single sub-segment cannot.
+//
+//    ds_heap_start                                                              ds_heap_end
+//    |                                                                                    |
+//    v                                                                                    v
+//    +====+----------------+---+====+----------------+---+- ... -+====+------------------+
+//    | rw |   no access    | G | rw |   no access    | G |       | rw |    no access     |
+//    +====+----------------+---+====+----------------+---+- ... -+====+------------------+
+//    ^    ^                    ^    ^                            ^    ^
+//    |    brk[0]               |    brk[1]                       |    brk[n-1]
+//    start[0]                  start[1]                          start[n-1]
+//
 // ds_release() releases all memory and resets all internal variables. A subsequent call to
 // ds_allocate() is supported and initializes a 'fresh' heap.
 //
+// File-backed segments and snapshots:
+// -----------------------------------
+// ds_allocate_file() maps the data segment copy-on-write (MAP_PRIVATE) over a file instead of
+// anonymous memory. The file holds an image of the entire data segment (guard pages included).
+// ds_snapshot() writes the pages below the brk of every sub-segment to the image, punches out the
+// pages above it, and appends an opaque metadata blob of the client (the allocator state) followed
+// by a DSSnapshot record with the address and layout of the data segment and the brk pointers of
+// all sub-segments.
+//
+//    0                                                        ds_size
+//    +--------------------------------------------------------+----------+------------+
+//    |               data segment image                       | metadata | DSSnapshot |
+//    +--------------------------------------------------------+----------+------------+
+//
+// ds_restore() maps the image back in at the address it was created at (MAP_FIXED_NOREPLACE),
+// so that all pointers stored in the heap and in the metadata remain valid, and restores the
+// brk pointers and the memory protection. It fails if the address range is occupied.
+//
+// The running heap never writes to the file, so the image always matches the record behind it:
+// a snapshot remains valid while the process continues to use the heap after ds_snapshot() or
+// ds_restore(), and it can be restored any number of times. It is replaced only by the next
+// ds_snapshot(), which removes the old record before it overwrites the image and writes the new
+// record last. An interrupted snapshot leaves a file without a valid record.
+// - explicit huge pages (DS_HUGETLB) and transparent huge pages are not supported for files
+// - modified pages occupy memory in addition to the page cache of the file
+// - pages released by lowering the brk are replaced with anonymous zero pages; the file is not
+//   touched until the next snapshot
+//
+
+#define _GNU_SOURCE
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "dataseg.h"
 
 
+/// @brief sub-segment of the user space heap with its own brk pointer
+typedef struct {
+  void *start;                      ///< start of the sub-segment
+  void *brk;                        ///< current logical end of the sub-segment
+  void *end;                        ///< end of the sub-segment
+  void *prot_end;                   ///< end of read/write area (brk rounded up to PAGESIZE)
+} DSSegment;
+
 static void *ds_start = NULL;       ///< start of the data segment
 static void *ds_end   = NULL;       ///< end of the data segment
 static void *ds_heap_start = NULL;  ///< start of the user space heap
-static void *ds_heap_brk   = NULL;  ///< current logical end of the user space heap
 static void *ds_heap_end   = NULL;  ///< end of the user space heap
+static DSSegment ds_seg[DS_MAXSEG]; ///< sub-segments of the user space heap
+static int  ds_nseg   = 0;          ///< number of sub-segments
 static int  PAGESIZE  = 0;          ///< (system) page size
 static int  ds_initialized = 0;     ///< initialized flag (yes: 1, otherwise 0)
 static int  ds_loglevel    = 0;     ///< log level (0: off; 1: info; 2: verbose)
 static int  ds_domprotect  = 1;     ///< mprotect() heap areas (0: off, 1: on)
+static int  ds_locked      = 0;     ///< data segment is locked in RAM (yes: 1, otherwise 0)
 static ssize_t ds_num_sbrk = 0;     ///< number of times ds_sbrk() was called with a non-zero 
                                     ///< argument
+static int  ds_fd     = -1;         ///< backing file (-1: anonymous memory)
+
+#ifndef MAP_FIXED_NOREPLACE
+  #define MAP_FIXED_NOREPLACE 0     ///< older systems: the mapping address is checked instead
+#endif
+
+/// @brief snapshot record in a backing file, stored behind the data segment image
+#define DS_SNAPMAGIC "DSSNAP01"     ///< magic number of a snapshot record
+typedef struct {
+  char magic[8];                    ///< DS_SNAPMAGIC
+  void *ds_start;                   ///< address of the data segment
+  size_t ds_size;                   ///< size of the data segment (and of the image)
+  int  pagesize;                    ///< page size
+  int  nseg;                        ///< number of sub-segments
+  DSSegment seg[DS_MAXSEG];         ///< sub-segments
+  size_t meta_size;                 ///< size of the client metadata preceding the record
+} DSSnapshot;
 
 
 /// @brief print a log message if level <= ds_loglevel. The variadic argument is a printf format
@@ -122,40 +210,202 @@ static void ds_log(int level, ...)
   #define LOG(level, ...)
 #endif
 
+/// @brief round @a p up to the next page boundary
+#define PAGE_UP(p)  ((void*)(((unsigned long)(p) + PAGESIZE-1) / PAGESIZE * PAGESIZE))
+
+/// @brief set memory protection of [@a from, @a to) to @a prot. Terminates on error.
+/// @param from page-aligned start address
+/// @param to   page-aligned end address
+/// @param prot protection flags
+static void ds_protect(void *from, void *to, int prot)
+{
+  if (from >= to) return;
+
+  LOG(2, "  setting memory protection:\n"
+         "    %-10s from %p to %p\n",
+         prot == PROT_NONE ? "NO ACCESS" : "READ/WRITE", from, to);
+
+  if (mprotect(from, to-from, prot) != 0) {
+    fprintf(stderr, "ERROR: cannot set memory protection flags in %s: %s.\n",
+            __func__, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+}
+
+/// @brief establish the memory protection of all sub-segments from scratch
+static void ds_syncprotect(void)
+{
+  for (int i=0; i<ds_nseg; i++) {
+    DSSegment *s = &ds_seg[i];
+
+    if (ds_domprotect) {
+      s->prot_end = PAGE_UP(s->brk);
+      ds_protect(s->start, s->prot_end, PROT_READ|PROT_WRITE);
+      ds_protect(s->prot_end, s->end, PROT_NONE);
+    } else {
+      s->prot_end = s->end;
+      ds_protect(s->start, s->end, PROT_READ|PROT_WRITE);
+    }
+  }
+}
+
+/// @brief release the pages [@a from, @a to) to the system; they read as zero when accessed again.
+///        File-backed pages are replaced with anonymous memory because discarding a private file
+///        mapping would expose the contents of the image.
+/// @param from page-aligned start address
+/// @param to   page-aligned end address
+static void ds_discard(void *from, void *to)
+{
+  int res;
+
+  if (ds_fd >= 0) {
+    int prot = ds_domprotect ? PROT_NONE : PROT_READ|PROT_WRITE;
+    res = mmap(from, to-from, prot, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0) == from ? 0 : -1;
+  } else {
+    res = madvise(from, to-from, MADV_DONTNEED);
+  }
+
+  if (res != 0) {
+    LOG(1, "  cannot release pages: %s", strerror(errno));
+  }
+}
+
+/// @brief write the pages [@a from, @a brk) of a sub-segment to the image at the same offset and
+///        punch the pages [@a brk, @a to) out of it, so that they read as zero after a restore
+/// @param from page-aligned start address
+/// @param brk  page-aligned end of the used area
+/// @param to   page-aligned end address
+/// @retval 0 on success
+/// @retval -1 on error. errno is set by pwrite()
+static int ds_writeimage(void *from, void *brk, void *to)
+{
+  while (from < brk) {
+    ssize_t res = pwrite(ds_fd, from, brk-from, from-ds_start);
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    from += res;
+  }
+
+  if ((brk < to) &&
+      (fallocate(ds_fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, brk-ds_start, to-brk) != 0)) {
+    LOG(1, "  cannot punch out pages above the brk: %s", strerror(errno));
+  }
+
+  return 0;
+}
+
+/// @brief determine the default size of explicit huge pages from /proc/meminfo
+/// @retval size of a huge page in bytes (2 MB if it cannot be determined)
+static size_t ds_gethugepagesize(void)
+{
+  size_t size = 2*1024*1024;
+  FILE *f = fopen("/proc/meminfo", "r");
+
+  if (f != NULL) {
+    char line[128];
+    unsigned long kb;
+    while (fgets(line, sizeof(line), f) != NULL) {
+      if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+        size = kb*1024;
+        break;
+      }
+    }
+    fclose(f);
+  }
+
+  return size;
+}
+
+
+static void ds_setup(int flags);
+
+
 void ds_allocate(size_t max_heap_size)
 {
-  LOG(1, "ds_allocate(%lx)", max_heap_size);
+  ds_allocate_ex(max_heap_size, 0);
+}
+
+
+void ds_allocate_ex(size_t max_heap_size, int flags)
+{
+  LOG(1, "ds_allocate_ex(%lx, %x)", max_heap_size, flags);
 
   if (ds_start != NULL) ds_release();
 
-  PAGESIZE = getpagesize();
-  size_t ds_size = max_heap_size + 2*PAGESIZE;
+  int mflags = MAP_PRIVATE|MAP_ANONYMOUS;
+  if (!(flags & DS_LAZY)) mflags |= MAP_POPULATE;
+
+  // allocate memory for the data segment. Explicit huge pages require huge-page alignment of all
+  // ranges we protect, so they become our page size. Fall back to regular pages if the system
+  // cannot provide huge pages.
+  ds_start = (void*)-1;
+  if (flags & DS_HUGETLB) {
+    PAGESIZE = ds_gethugepagesize();
+    size_t ds_size = (max_heap_size + PAGESIZE-1) / PAGESIZE * PAGESIZE + 2*PAGESIZE;
+
+    LOG(2, "  allocating %lx bytes of memory backed by huge pages", ds_size);
+    ds_start = mmap(NULL, ds_size, PROT_NONE, mflags|MAP_HUGETLB, -1, 0);
+    if (ds_start == (void*)-1) {
+      fprintf(stderr, "WARNING: cannot map huge pages in %s: %s.\n",
+                      __func__, strerror(errno));
+    } else {
+      ds_end = ds_start + ds_size;
+    }
+  }
 
-  // allocate memory for the data segment
-  LOG(2, "  allocating %lx bytes of memory", ds_size);
-  ds_start = mmap(NULL, ds_size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
   if (ds_start == (void*)-1) {
-    fprintf(stderr, "ERROR: cannot map memory in %s: %s.\n",
-                    __func__, strerror(errno));
-    exit(EXIT_FAILURE);
+    PAGESIZE = getpagesize();
+    size_t ds_size = (max_heap_size + PAGESIZE-1) / PAGESIZE * PAGESIZE + 2*PAGESIZE;
+
+    LOG(2, "  allocating %lx bytes of memory", ds_size);
+    ds_start = mmap(NULL, ds_size, PROT_NONE, mflags, -1, 0);
+    if (ds_start == (void*)-1) {
+      fprintf(stderr, "ERROR: cannot map memory in %s: %s.\n",
+                      __func__, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    ds_end = ds_start + ds_size;
+
+    // ask for transparent huge pages. Print only a warning if we don't succeed.
+    if ((flags & DS_HUGEPAGE) && (madvise(ds_start, ds_size, MADV_HUGEPAGE) != 0)) {
+      fprintf(stderr, "WARNING: cannot enable transparent huge pages in %s: %s.\n",
+                      __func__, strerror(errno));
+    }
   }
 
+  ds_setup(flags);
+}
+
+
+/// @brief lock the freshly mapped data segment [ds_start, ds_end) in RAM if requested by @a flags
+///        and initialize the heap pointers and a single sub-segment
+/// @param flags ds_allocate_ex() flags
+static void ds_setup(int flags)
+{
   // try to lock the memory in RAM. Print only a warning if we don't succeed.
-  /* don't do this for now. Requires changing resource limits in VM.
-  LOG(2, "  locking memory in DRAM...", ds_size);
-  if (mlock(ds_start, ds_size) < 0) {
-    fprintf(stderr, "WARNING: cannot lock memory in %s: %s.\n",
-                    __func__, strerror(errno));
+  // Requires a sufficient RLIMIT_MEMLOCK.
+  ds_locked = 0;
+  if (flags & DS_MLOCK) {
+    LOG(2, "  locking memory in DRAM...");
+    if (mlock(ds_start, ds_end-ds_start) < 0) {
+      fprintf(stderr, "WARNING: cannot lock memory in %s: %s.\n",
+                      __func__, strerror(errno));
+    } else {
+      ds_locked = 1;
+    }
   }
-  */
 
   // initalize pointers
-  ds_end         = ds_start + ds_size;
   ds_heap_start  = ds_start + PAGESIZE;
-  ds_heap_brk    = ds_heap_start;
   ds_heap_end    = ds_end - PAGESIZE;
+  ds_seg[0].start = ds_seg[0].brk = ds_seg[0].prot_end = ds_heap_start;
+  ds_seg[0].end  = ds_heap_end;
+  ds_nseg        = 1;
   ds_initialized = 1;
   ds_num_sbrk    = 0;
+  if (!ds_domprotect) ds_syncprotect();
 
   LOG(2, "  ds_start:           %p\n"
          "  ds_heap_start:      %p\n"
@@ -163,7 +413,210 @@ void ds_allocate(size_t max_heap_size)
          "  ds_heap_end:        %p\n"
          "  ds_end:             %p\n"
          "  PAGESIZE:           %d\n",
-         ds_start, ds_heap_start, ds_heap_brk, ds_heap_end, ds_end, PAGESIZE);
+         ds_start, ds_heap_start, ds_seg[0].brk, ds_heap_end, ds_end, PAGESIZE);
+}
+
+
+int ds_allocate_file(const char *path, size_t max_heap_size, int flags)
+{
+  LOG(1, "ds_allocate_file(%s, %lx, %x)", path, max_heap_size, flags);
+
+  if (ds_start != NULL) ds_release();
+
+  if (flags & (DS_HUGETLB|DS_HUGEPAGE)) {
+    fprintf(stderr, "WARNING: huge pages are not supported for file-backed data segments.\n");
+  }
+
+  PAGESIZE = getpagesize();
+  size_t ds_size = (max_heap_size + PAGESIZE-1) / PAGESIZE * PAGESIZE + 2*PAGESIZE;
+
+  int fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0600);
+  if (fd < 0) return -1;
+
+  // the image starts out as a hole and reads as zero like anonymous memory
+  if (ftruncate(fd, ds_size) != 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+
+  int mflags = MAP_PRIVATE;
+  if (!(flags & DS_LAZY)) mflags |= MAP_POPULATE;
+
+  LOG(2, "  mapping %lx bytes of %s", ds_size, path);
+  ds_start = mmap(NULL, ds_size, PROT_NONE, mflags, fd, 0);
+  if (ds_start == (void*)-1) {
+    int err = errno;
+    close(fd);
+    ds_start = NULL;
+    errno = err;
+    return -1;
+  }
+  ds_end = ds_start + ds_size;
+  ds_fd = fd;
+
+  ds_setup(flags);
+
+  return 0;
+}
+
+
+int ds_snapshot(const void *meta, size_t size)
+{
+  LOG(1, "ds_snapshot(%p, %lx)", meta, size);
+  assert(ds_initialized);
+
+  if (ds_fd < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  DSSnapshot snap;
+  memset(&snap, 0, sizeof(snap));
+  memcpy(snap.magic, DS_SNAPMAGIC, sizeof(snap.magic));
+  snap.ds_start  = ds_start;
+  snap.ds_size   = ds_end - ds_start;
+  snap.pagesize  = PAGESIZE;
+  snap.nseg      = ds_nseg;
+  memcpy(snap.seg, ds_seg, sizeof(snap.seg));
+  snap.meta_size = size;
+
+  // the old record is removed before the image is overwritten, and the new record is written
+  // last, once the image and the metadata are on disk. An interrupted snapshot leaves a file
+  // without a valid record at its end.
+  off_t ofs = snap.ds_size;
+  if (ftruncate(ds_fd, ofs) != 0) {
+    LOG(1, "  cannot write snapshot: %s", strerror(errno));
+    return -1;
+  }
+
+  for (int i=0; i<ds_nseg; i++) {
+    if (ds_writeimage(ds_seg[i].start, PAGE_UP(ds_seg[i].brk), ds_seg[i].end) != 0) {
+      LOG(1, "  cannot write image: %s", strerror(errno));
+      return -1;
+    }
+  }
+
+  if ((pwrite(ds_fd, meta, size, ofs) != (ssize_t)size) ||
+      (fsync(ds_fd) != 0) ||
+      (pwrite(ds_fd, &snap, sizeof(snap), ofs + size) != (ssize_t)sizeof(snap)) ||
+      (fsync(ds_fd) != 0)) {
+    LOG(1, "  cannot write snapshot: %s", strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+
+ssize_t ds_restore(const char *path, void *meta, size_t size)
+{
+  LOG(1, "ds_restore(%s, %p, %lx)", path, meta, size);
+
+  if (ds_start != NULL) ds_release();
+
+  int fd = open(path, O_RDWR);
+  if (fd < 0) return -1;
+
+  // read and check the snapshot record at the end of the file
+  DSSnapshot snap;
+  struct stat st;
+  int err = EINVAL;
+
+  if (fstat(fd, &st) != 0) {
+    err = errno;
+    goto fail;
+  }
+  if (st.st_size < (off_t)sizeof(snap)) {
+    LOG(1, "  %s too short for a snapshot", path);
+    goto fail;
+  }
+  if ((pread(fd, &snap, sizeof(snap), st.st_size - sizeof(snap)) != (ssize_t)sizeof(snap)) ||
+      (memcmp(snap.magic, DS_SNAPMAGIC, sizeof(snap.magic)) != 0) ||
+      (snap.pagesize != getpagesize()) || (snap.nseg < 1) || (snap.nseg > DS_MAXSEG) ||
+      ((off_t)(snap.ds_size + snap.meta_size + sizeof(snap)) != st.st_size)) {
+    LOG(1, "  no valid snapshot in %s", path);
+    goto fail;
+  }
+  if (snap.meta_size > size) {
+    LOG(1, "  metadata buffer too small (%lx < %lx)", size, snap.meta_size);
+    err = ENOSPC;
+    goto fail;
+  }
+  if (meta != NULL) {
+    ssize_t res = pread(fd, meta, snap.meta_size, snap.ds_size);
+    if (res != (ssize_t)snap.meta_size) {
+      if (res < 0) err = errno;                  // a short read keeps EINVAL
+      goto fail;
+    }
+  }
+
+  // map the image at its original address; pointers into the heap stay valid
+  LOG(2, "  mapping %lx bytes of %s at %p", snap.ds_size, path, snap.ds_start);
+  void *p = mmap(snap.ds_start, snap.ds_size, PROT_NONE, MAP_PRIVATE|MAP_FIXED_NOREPLACE, fd, 0);
+  if (p != snap.ds_start) {
+    if (p != (void*)-1) munmap(p, snap.ds_size);
+    LOG(1, "  address range %p - %p occupied", snap.ds_start, snap.ds_start + snap.ds_size);
+    err = EEXIST;
+    goto fail;
+  }
+
+  ds_start       = snap.ds_start;
+  ds_end         = ds_start + snap.ds_size;
+  ds_heap_start  = ds_start + snap.pagesize;
+  ds_heap_end    = ds_end - snap.pagesize;
+  PAGESIZE       = snap.pagesize;
+  memcpy(ds_seg, snap.seg, sizeof(ds_seg));
+  ds_nseg        = snap.nseg;
+  ds_fd          = fd;
+  ds_locked      = 0;
+  ds_initialized = 1;
+  ds_num_sbrk    = 0;
+  ds_syncprotect();
+
+  return snap.meta_size;
+
+fail:
+  close(fd);
+  errno = err;
+  return -1;
+}
+
+
+int ds_partition(int nseg)
+{
+  LOG(1, "ds_partition(%d)", nseg);
+  assert(ds_initialized);
+
+  for (int i=0; i<ds_nseg; i++) {
+    if (ds_seg[i].brk != ds_seg[i].start) {
+      LOG(1, "  data segment not clean");
+      errno = EBUSY;
+      return -1;
+    }
+  }
+
+  size_t stride = (ds_heap_end - ds_heap_start) / (nseg > 0 ? nseg : 1) / PAGESIZE * PAGESIZE;
+  if ((nseg < 1) || (nseg > DS_MAXSEG) || ((nseg > 1) && (stride < 2*(size_t)PAGESIZE))) {
+    LOG(1, "  invalid number of sub-segments");
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (int i=0; i<nseg; i++) {
+    ds_seg[i].start = ds_seg[i].brk = ds_heap_start + i*stride;
+    ds_seg[i].end   = i < nseg-1 ? ds_seg[i].start + stride - PAGESIZE : ds_heap_end;
+
+    LOG(2, "  sub-segment %2d: %p - %p", i, ds_seg[i].start, ds_seg[i].end);
+  }
+  ds_nseg = nseg;
+
+  // guard pages between sub-segments
+  ds_protect(ds_heap_start, ds_heap_end, PROT_NONE);
+  ds_syncprotect();
+
+  return 0;
 }
 
 
@@ -173,53 +626,66 @@ void ds_release(void)
 
   if (ds_start != NULL) {
     // unlock & release memory. Ignore error message here.
-    //munlock(ds_start, ds_end-ds_start);
+    if (ds_locked) munlock(ds_start, ds_end-ds_start);
     munmap(ds_start, ds_end-ds_start);
   }
+  if (ds_fd >= 0) close(ds_fd);
 
-  ds_start = ds_end = ds_heap_start = ds_heap_brk = ds_heap_end = NULL;
+  ds_start = ds_end = ds_heap_start = ds_heap_end = NULL;
+  memset(ds_seg, 0, sizeof(ds_seg));
+  ds_nseg  = 0;
   PAGESIZE = 0;
+  ds_locked = 0;
+  ds_fd     = -1;
   ds_initialized = 0;
 }
 
 
 void* ds_sbrk(intptr_t increment)
 {
-  LOG(1, "ds_sbrk(%c0x%lx)", increment < 0 ? '-' : '+', labs(increment));
+  return ds_sbrk_seg(0, increment);
+}
+
+
+void* ds_sbrk_seg(int seg, intptr_t increment)
+{
+  LOG(1, "ds_sbrk_seg(%d, %c0x%lx)", seg, increment < 0 ? '-' : '+', labs(increment));
   assert(ds_initialized);
+  assert((0 <= seg) && (seg < ds_nseg));
 
-  void *old_heap_brk = ds_heap_brk;
+  DSSegment *s = &ds_seg[seg];
+  void *old_heap_brk = s->brk;
 
   if (increment != 0) {
-    ds_heap_brk += increment;
-    ds_num_sbrk++;
+    void *ds_heap_brk = s->brk + increment;
+    __atomic_add_fetch(&ds_num_sbrk, 1, __ATOMIC_RELAXED);
+
+    if ((s->start <= ds_heap_brk) && (ds_heap_brk < s->end)) {
+      s->brk = ds_heap_brk;
 
-    if ((ds_heap_start <= ds_heap_brk) && (ds_heap_brk < ds_heap_end)) {
       if (ds_domprotect) {
-        // adjust memory access permissions
-        // since we are not forcing alignment of brk at PAGESIZE, we need to mark the invalid part
-        // before allowing access to the permissible area because permissions are set on a page-level
-        // basis
-        LOG(2, "  setting memory protection:\n"
-            "    READ/WRITE from %p to %p\n"
-            "    NO ACCESS  from %p to %p\n",
-            ds_heap_start, ds_heap_brk, ds_heap_brk, ds_end);
-
-        void *aligned_brk = (void*)(((unsigned long)ds_heap_brk) / PAGESIZE * PAGESIZE); // round down
-
-        if ((mprotect(aligned_brk, ds_end-aligned_brk, PROT_NONE) != 0) ||
-            (mprotect(ds_heap_start, ds_heap_brk-ds_heap_start, PROT_READ|PROT_WRITE) != 0))
-        {
-          fprintf(stderr, "ERROR: cannot set memory protection flags in %s: %s.\n", 
-              __func__, strerror(errno));
-          exit(EXIT_FAILURE);
-        }
+        // adjust memory access permissions. Permissions are set on a page-level basis, so the
+        // page containing the brk is accessible. Only the pages between the old and the new
+        // (page-aligned) brk change.
+        void *prot_end = PAGE_UP(ds_heap_brk);
+
+        if (prot_end > s->prot_end) ds_protect(s->prot_end, prot_end, PROT_READ|PROT_WRITE);
+        else ds_protect(prot_end, s->prot_end, PROT_NONE);
+
+        s->prot_end = prot_end;
+      }
+
+      if (increment < 0) {
+        // give pages that lie entirely above the new brk back to the system
+        void *from = PAGE_UP(ds_heap_brk);
+        void *to   = PAGE_UP(old_heap_brk);
+
+        if (from < to) ds_discard(from, to);
       }
     } else {
       // ignore increment and signal an error if we ended up outside the simulated data segment
       LOG(1, "  invalid increment (ended up outside valid data segment)");
       errno = ENOMEM;
-      ds_heap_brk = old_heap_brk;
       old_heap_brk = (void*)-1;
     }
   }
@@ -238,15 +704,35 @@ int ds_getpagesize(void)
 
 void ds_heap_stat(void **start, void **brk, void **end)
 {
-  if (start) *start = ds_heap_start;
-  if (brk)   *brk   = ds_heap_brk;
-  if (end)   *end   = ds_heap_end;
+  if (ds_nseg == 0) {
+    if (start) *start = NULL;
+    if (brk)   *brk   = NULL;
+    if (end)   *end   = NULL;
+  } else {
+    ds_heap_stat_seg(0, start, brk, end);
+  }
+}
+
+
+void ds_heap_stat_seg(int seg, void **start, void **brk, void **end)
+{
+  assert((0 <= seg) && (seg < ds_nseg));
+
+  if (start) *start = ds_seg[seg].start;
+  if (brk)   *brk   = ds_seg[seg].brk;
+  if (end)   *end   = ds_seg[seg].end;
+}
+
+
+int ds_getnseg(void)
+{
+  return ds_nseg;
 }
 
 
 ssize_t ds_getnsbrk(void)
 {
-  return ds_num_sbrk;
+  return __atomic_load_n(&ds_num_sbrk, __ATOMIC_RELAXED);
 }
 
 void ds_setloglevel(int level)
@@ -257,7 +743,10 @@ void ds_setloglevel(int level)
 
 void ds_setmprotect(int active)
 {
-  ds_domprotect = (active > 0);
+  if (ds_domprotect != (active > 0)) {
+    ds_domprotect = (active > 0);
+    if (ds_initialized) ds_syncprotect();
+  }
 }
 
 
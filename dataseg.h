@@ -34,35 +34,111 @@
 #ifndef __DATASEG_H__
 #define __DATASEG_H__
 
+#include <stdint.h>
 #include <unistd.h>
 
-/// @brief initialize simulated data segment. Allocates & locks memory pages in RAM to minimize
-///        performance variance.
+/// @brief maximum number of sub-segments supported by ds_partition()
+#define DS_MAXSEG 64
+
+/// @name ds_allocate_ex() flags
+/// @{
+#define DS_LAZY     0x1   ///< populate pages on first access instead of up front
+#define DS_HUGEPAGE 0x2   ///< request transparent huge pages (MADV_HUGEPAGE)
+#define DS_HUGETLB  0x4   ///< back data segment with explicit huge pages (MAP_HUGETLB)
+#define DS_MLOCK    0x8   ///< lock data segment in RAM
+/// @}
+
+/// @brief initialize simulated data segment. Allocates & populates all memory pages up front to
+///        minimize performance variance.
 /// @param max_heap_size maximum possible size of heap data segment
 void ds_allocate(size_t max_heap_size);
 
+/// @brief initialize simulated data segment with the options given in @a flags. Options that
+///        cannot be honored by the system are ignored with a warning.
+/// @param max_heap_size maximum possible size of heap data segment
+/// @param flags bitwise OR of DS_LAZY, DS_HUGEPAGE, DS_HUGETLB, DS_MLOCK (0: same as ds_allocate)
+void ds_allocate_ex(size_t max_heap_size, int flags);
+
+/// @brief initialize simulated data segment backed by the file @a path (MAP_PRIVATE). The file is
+///        created or truncated and holds an image of the entire data segment. Changes to the heap
+///        reach the file only through ds_snapshot().
+/// @param path backing file
+/// @param max_heap_size maximum possible size of heap data segment
+/// @param flags bitwise OR of DS_LAZY, DS_MLOCK. Huge pages are ignored with a warning.
+/// @retval 0 on success
+/// @retval -1 on error. errno is set by open(), ftruncate(), or mmap()
+int ds_allocate_file(const char *path, size_t max_heap_size, int flags);
+
+/// @brief write a snapshot of a file-backed data segment: write the image and append @a meta and
+///        the layout of the data segment (address, sub-segments and their brk pointers). The
+///        snapshot replaces the previous one and is not affected by later changes to the heap.
+/// @param meta opaque client metadata stored with the snapshot
+/// @param size size of @a meta in bytes
+/// @retval 0 on success
+/// @retval -1 on error. errno is EINVAL if the data segment is not file-backed
+int ds_snapshot(const void *meta, size_t size);
+
+/// @brief restore a data segment from a snapshot in @a path. The image is mapped copy-on-write at
+///        its original address, so the snapshot remains valid. A current data segment is released
+///        first.
+/// @param path file written by ds_snapshot()
+/// @param meta buffer receiving the client metadata (may be NULL)
+/// @param size size of @a meta in bytes
+/// @retval size of the stored metadata on success
+/// @retval -1 on error. errno is set to EINVAL (no valid snapshot), ENOSPC (@a meta too small),
+///         EEXIST (original address range occupied), or by open()
+ssize_t ds_restore(const char *path, void *meta, size_t size);
+
+/// @brief partition the heap area of a clean data segment into @a nseg page-aligned sub-segments
+///        of equal size, each with its own brk pointer. Sub-segments are separated by a guard page.
+/// @param nseg number of sub-segments (1..DS_MAXSEG). 1 restores the unpartitioned heap.
+/// @retval 0 on success
+/// @retval -1 on error. errno is set to EINVAL (invalid @a nseg) or EBUSY (heap not clean)
+int ds_partition(int nseg);
+
 /// @brief release simulated data segment
 void ds_release(void);
 
 /// @brief sbrk() implementation on our simulated data segment. Operates exactly as the kernel's
 ///        sbrk() function (see man sbrk)
-/// @param increment offset by which to increase/decrease current brk.
+/// @param increment offset by which to increase/decrease current brk. Pages no longer covered by
+///        the heap after a decrease are released to the system.
 /// @retval old brk on success.
 /// @retval (void*)-1 on error. errno is set to ENOMEM
 void* ds_sbrk(intptr_t increment);
 
+/// @brief sbrk() implementation on sub-segment @a seg of our simulated data segment. Different
+///        sub-segments may be adjusted concurrently.
+/// @param seg sub-segment index
+/// @param increment offset by which to increase/decrease the brk of sub-segment @a seg.
+/// @retval old brk of sub-segment @a seg on success.
+/// @retval (void*)-1 on error. errno is set to ENOMEM
+void* ds_sbrk_seg(int seg, intptr_t increment);
+
 /// @brief retrieve pagesize of data segment
 /// @retval page size
 /// @retval 0 if not data segment not initialized)
 int ds_getpagesize(void);
 
-/// @brief retrieve statistics about our data segment. Returns start, end, and current brk address.
+/// @brief retrieve statistics about our data segment. Returns start, end, and current brk address
+///        of sub-segment 0, i.e., of the entire heap if the data segment is not partitioned.
 /// @param[out] start starting address of user-space heap
 /// @param[out] brk   current break pointer of user-space heap
 /// @param[out] end   largest possible address of user-space heap
 /// @param[out] nsbrk number of times sbrk() was called with a non-zero argument
 void ds_heap_stat(void **start, void **brk, void **end);
 
+/// @brief retrieve start, end, and current brk address of sub-segment @a seg
+/// @param seg sub-segment index
+/// @param[out] start starting address of sub-segment
+/// @param[out] brk   current break pointer of sub-segment
+/// @param[out] end   largest possible address of sub-segment
+void ds_heap_stat_seg(int seg, void **start, void **brk, void **end);
+
+/// @brief retrieve the number of sub-segments of the data segment
+/// @retval int number of sub-segments (1 if not partitioned, 0 if not initialized)
+int ds_getnseg(void);
+
 /// @brief retrieve the number of sbrk() was called with a non-zero argument
 /// @retval ssize_t number of sbrk() calls
 ssize_t ds_getnsbrk(void);
@@ -66,17 +66,303 @@
 // - block splitting: always at 32-byte boundaries
 // - immediate coalescing upon free
 //
+// Segregated free lists:
+// ----------------------
+// - block layout identical to the explicit free list (h : n : p : ... : f)
+// - free blocks are kept in NUM_CLASSES explicit lists, bucketed by size class:
+//   - classes 0-7 hold exactly one size each (32, 64, ..., 256 bytes)
+//   - above 256 bytes, every power-of-two range is split into four sub-classes
+//   - the last class collects all remaining (large) blocks
+// - seg_bitmap has bit i set iff list i is non-empty
+// - allocation policy: good fit. The list of the requested class is searched first; if it
+//   contains no large enough block, the head of the next non-empty class is taken. Every block
+//   in a larger class is guaranteed to fit, so a lookup touches at most two lists.
+// - block splitting: always at 32-byte boundaries, the remainder is re-binned
+// - immediate coalescing upon free, merged neighbours are unlinked from their lists
+//
+// Size-ordered free tree:
+// -----------------------
+// - minimal block size: 32 bytes. Free blocks of exactly 32 bytes are kept in free_list.
+// - free blocks of 64 bytes or more are nodes of a treap keyed by block size:
+//
+//               +---+---+---+---+---+---+-- ... --+---+
+//               | h : n : p : l : r : q :         : f |
+//               +---+---+---+---+---+---+-- ... --+---+
+//
+//   - l,r: left/right child; q: treap priority (derived from the address on insertion)
+//   - n,p: blocks of equal size are chained off the tree node. The tree node has p == NULL,
+//     chained blocks point to their predecessor in the chain (the first one to the tree node).
+// - allocation policy: best fit in O(log n). The search returns immediately on an exact match
+//   and prefers chained blocks which can be unlinked in O(1).
+// - block splitting: always at 32-byte boundaries
+// - immediate coalescing upon free
+//
+// Address-ordered free list:
+// --------------------------
+// - fp_AddrOrdered and fp_NextFit keep all free blocks in one explicit list sorted by address.
+//   The list is the bottom level of a skip list; free blocks carry up to SKIP_MAXLEVEL-1 more
+//   forward links behind n and p:
+//
+//               +---+---+---+---+---+-- ... --+---+
+//               | h : n : p : 1 : 2 :         : f |
+//               +---+---+---+---+---+-- ... --+---+
+//
+//   - 1,2,...: forward links on levels 1, 2, ...
+//   - the height of a block is derived from its address (a level is added with probability 1/4)
+//     and limited by its size, so it need not be stored. 32-byte blocks are on level 0 only.
+// - insertion and removal in O(log n) expected; removal of blocks of height 1 is O(1)
+// - allocation policy (fp_AddrOrdered): first fit in address order. Allocations cluster at low
+//   addresses and free blocks at the top of the heap are left intact.
+// - allocation policy (fp_NextFit): first fit from a roving pointer, the address of the block
+//   found by the previous search. The skip list finds the first free block at this address in
+//   O(log n); the remainder of a split block is found first by the next search, so allocations
+//   issued together end up next to each other. The free block at the top of the heap is taken
+//   only if no other block fits: the rover otherwise runs ahead into it after every heap growth
+//   and leaves the holes below behind, which roughly halves peak utilization.
+// - block splitting: always at 32-byte boundaries
+// - immediate coalescing upon free
+//
+// Footer elision:
+// ----------------
+// Every header records the status of the preceeding block in its PREV_ALLOC bit; coalescing
+// thus never has to read the footer of an allocated block. With MM_NOFOOTER (see mm_init_ex()),
+// allocated blocks carry no footer and the payload extends over the last word of the block:
+//
+//               +---+-------- ... --------+---+           +---+-------- ... --------+
+//               | h :                     : f |           | H :                     |
+//               +---+-------- ... --------+---+           +---+-------- ... --------+
+//                      free block                             allocated block
+//
+// - per-block overhead of allocated blocks: 8 instead of 16 bytes (e.g., a 24-byte request fits
+//   into a 32-byte block)
+// - free blocks keep their footer which is needed to find their header when coalescing
+// - double frees are detected with the PREV_ALLOC bit of the next block instead of the footer
+//
+// The PREV_ALLOC bit makes the header of a block shared between two owners: the thread freeing
+// the previous block reads it without holding the arena lock (free checks, thread cache), while
+// operations on the block itself update it under the lock. All writers hold the lock, so headers
+// are updated with relaxed atomic stores (set_alloc(), set_free()) and read on unlocked paths
+// with relaxed atomic loads (GET_SHARED()). Both compile to plain moves; they only make the
+// accesses well-defined (and quiet under ThreadSanitizer).
+//
+// Slabs:
+// ------
+// With MM_SLAB (see mm_init_ex()), requests of up to SLAB_MAXSIZE bytes are served from slabs
+// instead of individual blocks. A slab is an allocated block of SLAB_SIZE bytes whose header is
+// SLAB_SIZE-aligned. It is carved into equal-sized slots of one of SLAB_NCLASSES sizes:
+//
+//               +---+---+---+---+-- ... --+------+------+-- ... --+------+---+
+//               | H : n : p : c :   map   | slot | slot |         | slot | F |
+//               +---+---+---+---+-- ... --+------+------+-- ... --+------+---+
+//               ^
+//               SLAB_SIZE-aligned
+//
+// - n,p: next/previous slab of the same class with free slots; c: class and slot counts
+// - map: bitmap of free slots (bit set: slot free)
+// - slots carry no boundary tags. Each arena keeps a bitmap with one bit per SLAB_SIZE page
+//   of its sub-segment that identifies slab pages; mm_free() finds the slab of a pointer by
+//   masking its address.
+// - a slab is returned to the heap when its last slot is freed, unless it is the only slab of
+//   its class with free slots
+//
+// Direct mappings:
+// ----------------
+// Requests of MMAPTHLD bytes or more bypass the arenas (see mm_setmmapthreshold()). Each one gets
+// a private mapping of its own that is unmapped as soon as it is freed:
+//
+//               +---------+---+---+------------------ ... ------------------+
+//               |   ???   | o | M |  payload                                 |
+//               +---------+---+---+------------------ ... ------------------+
+//               ^                 ^
+//               page-aligned      32-byte aligned (or aligned as requested by mm_memalign())
+//
+// - M: header holding the size of the mapping and the MMAPPED and ALLOC flags. This combination
+//   never appears in the header of a heap block.
+// - o: offset of the payload from the start of the mapping
+// - mm_realloc() resizes mappings with mremap(), which moves the pages instead of copying them.
+//   Heap blocks that grow beyond MMAPTHLD are moved to a mapping instead of growing the heap.
+//
+// Aligned allocation:
+// -------------------
+// Heap block headers are 32-byte aligned, so payloads are only 8-byte aligned. mm_memalign()
+// places the payload ALIGN_OFS bytes behind the header instead and marks the word in front of
+// it with an align tag, a word with MMAPPED set and ALLOC clear holding the offset of the header:
+//
+//               +---+---+---+---+------------------ ... --------+---+
+//               | H :   ?   : t |  payload                      : F |
+//               +---+---+---+---+------------------ ... --------+---+
+//               ^               ^
+//               32-byte aligned aligned to requested boundary
+//
+// - the free block is split such that the payload lands on the requested boundary. The leading
+//   part remains on the free list.
+// - aligned blocks are ordinary heap blocks otherwise. mm_free() and mm_realloc() follow the tag
+//   to the header.
+//
+// Zeroed allocation:
+// ------------------
+// Memory exposed by ds_sbrk() for the first time is zero. Every arena tracks a watermark,
+// zero_start, above which the heap has never held an allocated block. Invariant: all words in
+// [zero_start, ds_heap_brk) are zero except for the header, free-list links, and footer of the
+// top free block and the end sentinel.
+// - allocating a block raises the watermark to the end of the block
+// - coalescing clears or covers the tags of merged blocks that would otherwise remain above the
+//   watermark
+// - shrinking the heap raises the watermark to the old break; released memory is not trusted
+// mm_calloc() only clears the first FREE_TAGS-WSIZE bytes (and the last word without footers)
+// of blocks allocated above the watermark. Other blocks are cleared completely, with
+// non-temporal stores for areas of NTZERO_THLD bytes or more. Direct mappings are always zero.
+//
+// Statistics:
+// -----------
+// mm_getstats() reports counters that are maintained incrementally:
+// - per arena, under the arena lock: free bytes/blocks (list_insert/list_remove), allocated
+//   blocks (place/heap_release), get_free_block() search lengths, and heap growth/shrinkage.
+//   The largest free block is tracked as a maximum; only when it is removed is it found again
+//   by a search on the next mm_getstats() call.
+// - per thread, in the thread cache: malloc/free calls by size class. Single-writer counters,
+//   summed over all registered caches (plus those of exited threads) by mm_getstats().
+// mm_getstats() locks all arenas, so the heap counters form a consistent snapshot.
+// The free block size distribution (free_hist) is maintained the same way, so the fragmentation
+// metrics cost no heap walk either.
+//
+// Heap walks:
+// -----------
+// mm_iterate() reports every heap block to a callback; mm_export() uses it to write a heap map
+// as CSV or as binary records. Arenas are walked one at a time with only that arena locked,
+// so threads allocating from other arenas are not held up.
+//
+// Validation:
+// -----------
+// mm_check() walks and dumps the entire heap. For long-running processes, mm_setvalidation()
+// enables checks whose cost is proportional to the number of operations instead:
+// - local checks: place() and coalesce() verify the block they produce: header against footer,
+//   the prev bit of the next block, the footer of a free predecessor, that free blocks are
+//   coalesced, and that their free list (or tree) links point back at them.
+// - sampling: every VALIDATEPERIOD-th operation of an arena (on average; the distance between
+//   samples is random) verifies a region of at least VALIDATE_SPAN blocks in address order and
+//   VALIDATE_SPAN blocks along the free list of its first block. Consecutive regions sweep
+//   through the heap: the next region starts at the free block where the previous one ended
+//   (vcursor) and wraps around to the heap start at the end. When the block at vcursor leaves
+//   its free list, the sweep restarts at a random free block (at the heap start for the implicit
+//   policy); free blocks are reachable from the list heads without a heap walk.
+// Inconsistencies terminate the process with PANIC().
+//
+// Tracing:
+// --------
+// mm_trace_start() records every allocation call (timestamp, operation, size, pointers) into a
+// binary trace file that mm_bench can replay. The public entry points are thin wrappers around
+// the *_impl() functions, which call each other without being recorded twice.
+// - every thread appends to its own ring buffer (TraceBuf, allocated with mmap()). The owning
+//   thread is the only producer and a flusher thread the only consumer, so recording takes no
+//   lock; when a buffer is full, records are dropped and counted.
+// - the flusher thread writes the new records of all buffers to the file; it sleeps for
+//   TRACE_INTERVAL ns whenever there were none
+// - when tracing is off, the only cost is the test of mm_tracing in TRACE()
+// Buffers are kept across trace sessions; those of exited threads are released by
+// mm_trace_stop().
+//
+// Latency instrumentation:
+// ------------------------
+// Compiled in with -DMM_TIMING (like LOG() with -DDEBUG); otherwise the timer macros expand to
+// nothing. The API calls and their phases (arena lock wait, search, split, coalesce, heap
+// extension, sbrk, trimming, direct mappings) are timed with clock_gettime() and counted in
+// per-thread log-linear histograms in the thread cache: values below 16 ns have a bucket each,
+// every larger power of two is split into 8 buckets (12.5% resolution). mm_getlatency() sums
+// the histograms of all threads like mm_getstats() sums the call counters. Phases nest: the
+// time of a malloc includes that of its search, split, and so on.
+//
+// Heap growth:
+// ------------
+// The heap is extended by at least the arena's current chunk size, which starts at CHUNKSIZE
+// and doubles with every extension up to MAXCHUNKSIZE (see mm_setgrowth()). Workloads that keep
+// growing the heap thus need O(log n) instead of O(n) calls to ds_sbrk(). If the data segment
+// cannot provide a full chunk, the heap is extended by the requested size only.
+//
+// Heap trimming:
+// --------------
+// When a free (or realloc) leaves a free block in front of the end sentinel that is larger than
+// the current chunk size + SHRINKTHLD, the block is cut down to the chunk size, the end sentinel
+// is moved down, and the freed tail is returned to the data segment with a negative ds_sbrk().
+// Keeping one chunk avoids growing and shrinking the heap on alternating malloc/free calls.
+// Every trim halves the chunk size (down to CHUNKSIZE) so that growth adapts to lower demand.
+// mm_trim() trims all arenas explicitly down to a user-supplied pad.
+//
+// Arenas:
+// -------
+// mm_init() creates one arena per sub-segment of the data segment (see ds_partition()). Each
+// arena is an independent heap as described above with its own sentinels, free lists, and lock.
+// - threads are assigned a home arena round-robin when they first use the allocator
+// - allocations are served from the home arena; other arenas are tried only if it is exhausted
+// - blocks are always returned to the arena that owns them, found from the block address
+//
+// Thread caches:
+// --------------
+// In front of the arenas, every thread owns a cache of small blocks (up to TCACHE_MAXSIZE
+// bytes) with one LIFO bin per block size. Bins are singly-linked through the n word of the
+// cached blocks.
+// - cached blocks keep their allocated boundary tags; to their arena they are in use
+// - mm_malloc/mm_free of small blocks are served from the bins without locking
+// - an empty bin is refilled from the home arena with tcache_count/2 blocks holding its lock once
+// - a full bin is flushed by returning half of its blocks to their arenas
+// - on thread exit, the cache is flushed completely; mm_init invalidates all caches
+//
+// Deferred coalescing:
+// --------------------
+// With MM_DEFER, blocks of up to DEFER_MAXSIZE bytes returned to an arena (by mm_free or thread
+// cache flushes) are not coalesced but put into per-arena LIFO bins by size, like the thread
+// caches keeping their allocated boundary tags. A request of the same size is served from its
+// bin as-is, which avoids repeated coalescing and splitting in alloc/free ping-pong patterns.
+// - all bins of an arena are consolidated (their blocks freed and coalesced) in bulk when one
+//   of them exceeds DEFER_COUNT blocks, when a free block search fails, and by mm_trim
+// - blocks in the bins are in use from the heap's point of view (statistics, heap walks)
+//
+// Specialized builds:
+// -------------------
+// By default, the free list policy and the layout options are selected at run time by
+// mm_init_ex(): the free block search is called through get_free_block and policy and option
+// tests are branches on global variables. Defining MM_POLICY and/or MM_OPTIONS at compile time
+// turns these globals into constants, so the compiler calls (and inlines) the search directly
+// and removes the code of all other configurations. Each variant is a separate object file:
+//
+//    gcc -O2 -DMM_POLICY=fp_Segregated -DMM_OPTIONS=MM_SLAB -c memmgr.c -o memmgr_seg.o
+//
+// mm_init_ex() terminates the process for other configurations (see MM_SUPPORTED()). MM_BS
+// changes the block size and alignment, and MM_NOINSTR removes the tests of the tracing and
+// validation switches from the fast paths (mm_trace_start() fails, mm_setvalidation() is
+// ignored). Latency instrumentation is compiled in only with MM_TIMING.
+//
+// Snapshots:
+// ----------
+// On a file-backed data segment (ds_allocate_file()), mm_snapshot() persists the heap: the data
+// segment writes the heap image to the file, and the allocator metadata outside the data segment
+// (the policy, the layout options, and the arenas) is stored with its snapshot record. Later
+// allocations do not reach the file, so the snapshot stays consistent until the next one.
+// mm_restore() maps the heap back in and reinstalls the metadata, after which allocation simply
+// continues. The heap is full of absolute pointers (free lists, trees, slabs), so instead of
+// relocating them the data segment is restored at its original address.
+// - direct mappings live outside the data segment; mm_snapshot() fails while any are live
+// - the caller's thread cache is flushed; blocks cached by other threads remain allocated
+// - statistics of the thread caches (call counts, latencies) are not persisted
+//
 
 #define _GNU_SOURCE
 
 #include <assert.h>
+#include <errno.h>
 #include <error.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "dataseg.h"
 #include "memmgr.h"
@@ -84,22 +370,40 @@
 
 /// @name global variables
 /// @{
-static void *ds_heap_start = NULL;                     ///< physical start of data segment
-static void *ds_heap_brk   = NULL;                     ///< physical end of data segment
-static void *heap_start    = NULL;                     ///< logical start of heap
-static void *heap_end      = NULL;                     ///< logical end of heap
 static int  PAGESIZE       = 0;                        ///< memory system page size
-static void *(*get_free_block)(size_t) = NULL;         ///< get free block for selected allocation policy
 static size_t CHUNKSIZE    = 1<<16;                    ///< minimal data segment allocation unit
-static size_t SHRINKTHLD   = 1<<14;                    ///< threshold to shrink heap
+static size_t MAXCHUNKSIZE = 1<<22;                    ///< maximal data segment allocation unit
+static size_t SHRINKTHLD   = 1<<14;                    ///< excess of top free block over CHUNKSIZE
+                                                       ///< that triggers shrinking the heap
+static size_t MMAPTHLD     = 1<<20;                    ///< requests of at least MMAPTHLD bytes get
+                                                       ///< a direct mapping (0: off)
 static int  mm_initialized = 0;                        ///< initialized flag (yes: 1, otherwise 0)
 static int  mm_loglevel    = 0;                        ///< log level (0: off; 1: info; 2: verbose)
-
-static void* extend_heap(size_t words);
-static void* coalesce(void *bp);
+#ifndef MM_OPTIONS
+static int  mm_footers     = 1;                        ///< allocated blocks have a footer (yes: 1, no: 0)
+static int  mm_slab        = 0;                        ///< serve tiny requests from slabs (yes: 1, no: 0)
+static int  mm_defer       = 0;                        ///< deferred coalescing (yes: 1, no: 0)
+#else
+static const int mm_footers = !((MM_OPTIONS) & MM_NOFOOTER); ///< fixed at compile time
+static const int mm_slab    = !!((MM_OPTIONS) & MM_SLAB);    ///< fixed at compile time
+static const int mm_defer   = !!((MM_OPTIONS) & MM_DEFER);   ///< fixed at compile time
+#endif
+#ifndef MM_NOINSTR
+static int  mm_validate    = 0;                        ///< local checks on every operation (yes: 1, no: 0)
+static unsigned long VALIDATEPERIOD = 0;               ///< operations per sampled region (0: off)
+#else
+static const int mm_validate = 0;                      ///< validation compiled out
+#endif
 
 // Freelist
+#ifndef MM_POLICY
 static FreelistPolicy freelist_policy  = 0;            ///< free list management policy
+static int  mm_ordered     = 0;                        ///< free list in address order (yes: 1, no: 0)
+#else
+static const FreelistPolicy freelist_policy = MM_POLICY; ///< fixed at compile time
+static const int mm_ordered = ((MM_POLICY) == fp_AddrOrdered) || ((MM_POLICY) == fp_NextFit);
+                                                       ///< fixed at compile time
+#endif
 
 
 //
@@ -110,16 +414,27 @@ static FreelistPolicy freelist_policy  = 0;            ///< free list management
 /// @name Macro definitions
 /// @{
 #define MAX(a, b)          ((a) > (b) ? (a) : (b))     ///< MAX function
+#define MIN(a, b)          ((a) < (b) ? (a) : (b))     ///< MIN function
 
 #define TYPE               unsigned long               ///< word type of heap
 #define TYPE_SIZE          sizeof(TYPE)                ///< size of word type
 
 #define ALLOC              1                           ///< block allocated flag
 #define FREE               0                           ///< block free flag
+#define PREV_ALLOC         2                           ///< previous block allocated flag
+#define MMAPPED            4                           ///< block is a direct mapping flag
+#define IS_MMAPPED(v)      (((v) & (MMAPPED|ALLOC)) == (MMAPPED|ALLOC)) ///< header of direct mapping
+#define IS_ALIGNTAG(v)     (((v) & (MMAPPED|ALLOC)) == MMAPPED)         ///< align tag
 #define STATUS_MASK        ((TYPE)(0x7))               ///< mask to retrieve flags from header/footer
 #define SIZE_MASK          (~STATUS_MASK)              ///< mask to retrieve size from header/footer
 
-#define BS                 32                          ///< minimal block size. Must be a power of 2
+#ifndef MM_BS
+  #define MM_BS            32                          ///< default block size/alignment
+#endif
+#define BS                 MM_BS                       ///< minimal block size. Must be a power of 2
+#if (MM_BS < 32) || (MM_BS & (MM_BS-1))
+  #error "MM_BS must be a power of 2 of at least 32 (header, two links, footer)"
+#endif
 #define BS_MASK            (~(BS-1))                   ///< alignment mask
 
 #define WORD(p)            ((TYPE)(p))                 ///< convert pointer to TYPE
@@ -132,12 +447,18 @@ static FreelistPolicy freelist_policy  = 0;            ///< free list management
 
 #define PACK(size,status)  ((size) | (status))         ///< pack size & status into boundary tag
 #define SIZE(v)            (v & SIZE_MASK)             ///< extract size from boundary tag
-#define STATUS(v)          (v & STATUS_MASK)           ///< extract status from boundary tag
+#define STATUS(v)          (v & ALLOC)                 ///< extract status from boundary tag
 
 #define PUT(p, v)          (*(TYPE*)(p) = (TYPE)(v))   ///< write word v to *p
 #define GET(p)             (*(TYPE*)(p))               ///< read word at *p
 #define GET_SIZE(p)        (SIZE(GET(p)))              ///< extract size from header/footer
 #define GET_STATUS(p)      (STATUS(GET(p)))            ///< extract status from header/footer
+#define GET_PREV_ALLOC(p)  (GET(p) & PREV_ALLOC)       ///< extract previous block status from header
+
+#define GET_SHARED(p)      __atomic_load_n((TYPE*)(p), __ATOMIC_RELAXED) ///< read header outside the
+                                                       ///< arena lock
+#define PUT_SHARED(p, v)   __atomic_store_n((TYPE*)(p), (TYPE)(v), __ATOMIC_RELAXED) ///< write header
+                                                       ///< that may be read outside the arena lock
 
 
 //
@@ -147,6 +468,225 @@ static FreelistPolicy freelist_policy  = 0;            ///< free list management
 #define DSIZE       16
 #define NEXT_LIST_GET(p)  (*(void **)(p + WSIZE))
 #define PREV_LIST_GET(p)  (*(void **)(p + 2*WSIZE))
+
+#define NUM_CLASSES        MM_NCLASSES                 ///< number of segregated size classes
+#define ROUND_BS(s)        (((s)+BS-1) & BS_MASK)      ///< round size up to multiple of BS
+#define NEXT_BLK(p)        ((p)+GET_SIZE(p))           ///< get header of next block
+#define PREV_BLK(p)        ((p)-GET_SIZE(PREV_PTR(p))) ///< get header of previous block
+
+#define LEFT_TREE_GET(p)   (*(void **)(p + 3*WSIZE))   ///< left child of tree node
+#define RIGHT_TREE_GET(p)  (*(void **)(p + 4*WSIZE))   ///< right child of tree node
+#define PRIO_TREE_GET(p)   (*(TYPE *)(p + 5*WSIZE))    ///< treap priority of tree node
+#define TREE_MINSIZE       (2*BS)                      ///< smallest block managed by the tree
+#define SKIP_MAXLEVEL      12                          ///< levels of the address-ordered skip list
+#define SKIP_LINK(p, l)    (*(void **)(p + (2+(l))*WSIZE)) ///< forward link on level l >= 1
+#define FREE_TAGS          ((2+SKIP_MAXLEVEL)*WSIZE)   ///< extent of header & links of free block
+#define NTZERO_THLD        (1<<18)                     ///< clear with non-temporal stores from here
+
+#define OVERHEAD           (mm_footers ? 2*TYPE_SIZE : TYPE_SIZE) ///< boundary tags of allocated block
+/// @}
+
+
+/// @name arenas
+/// @{
+#define MAX_ARENAS         DS_MAXSEG                   ///< maximum number of arenas
+
+/// @name slabs
+/// @{
+#define SLAB_SIZE          4096                        ///< size and alignment of a slab
+#define SLAB_NCLASSES      6                           ///< number of slot sizes
+#define SLAB_MAXSIZE       64                          ///< largest request served from slabs
+#define SLAB_MAPWORDS      8                           ///< bitmap words (enough for 8-byte slots)
+
+/// @brief slab header. Overlays the start of the heap block holding the slab.
+typedef struct Slab {
+  TYPE hdr;                                            ///< header of the enclosing heap block
+  struct Slab *next;                                   ///< next slab of class with free slots
+  struct Slab *prev;                                   ///< previous slab of class with free slots
+  unsigned short cls;                                  ///< slot size class
+  unsigned short nslots;                               ///< number of slots
+  unsigned short nfree;                                ///< number of free slots
+  unsigned short pad;                                  ///< unused
+  uint64_t map[SLAB_MAPWORDS];                         ///< free slots (bit i set: slot i free)
+} Slab;
+
+#define SLAB_HDRSIZE       ROUND_BS(sizeof(Slab))      ///< offset of first slot in slab
+
+static const size_t slab_slotsize[SLAB_NCLASSES] = { 8, 16, 24, 32, 48, 64 };
+static const int slab_class[SLAB_MAXSIZE/8+1] = { 0, 0, 1, 2, 3, 4, 4, 5, 5 };
+/// @}
+
+/// @name deferred coalescing
+/// @{
+#define DEFER_MAXSIZE      512                         ///< largest block size held in deferred bins
+#define DEFER_NBINS        (DEFER_MAXSIZE/BS)          ///< number of deferred bins per arena
+#define DEFER_COUNT        64                          ///< max. blocks per bin before consolidation
+/// @}
+
+
+/// @brief independent heap on one data sub-segment
+typedef struct {
+  pthread_mutex_t lock;                                ///< protects the arena
+  int  seg;                                            ///< data sub-segment index
+  void *ds_heap_start;                                 ///< physical start of data sub-segment
+  void *ds_heap_brk;                                   ///< physical end of data sub-segment
+  void *heap_start;                                    ///< logical start of heap
+  void *heap_end;                                      ///< logical end of heap
+  size_t chunksize;                                    ///< current heap extension size
+  void *zero_start;                                    ///< heap above is zero (except free tags)
+  size_t free_bytes;                                   ///< stats: bytes in free blocks
+  unsigned long free_blocks;                           ///< stats: number of free blocks
+  unsigned long inuse_blocks;                          ///< stats: number of allocated blocks
+  size_t largest_free;                                 ///< stats: upper bound of largest free block
+  unsigned long free_hist[MM_NCLASSES];                ///< stats: free blocks by size class
+  int  largest_stale;                                  ///< stats: largest_free must be searched
+  unsigned long search_len;                            ///< stats: blocks inspected by current search
+  unsigned long search_hist[MM_NSEARCH];               ///< stats: searches by blocks inspected
+  unsigned long nsbrk_grow;                            ///< stats: number of heap extensions
+  unsigned long nsbrk_shrink;                          ///< stats: number of heap reductions
+  size_t sbrk_grow_bytes;                              ///< stats: total heap extension in bytes
+  size_t sbrk_shrink_bytes;                            ///< stats: total heap reduction in bytes
+  void *free_list;                                     ///< head of explicit free list
+  void *seg_list[NUM_CLASSES];                         ///< heads of segregated free lists
+  uint64_t seg_bitmap;                                 ///< non-empty segregated lists (bit i: list i)
+  void *tree_root;                                     ///< root of size-ordered free tree
+  void *skip_head[SKIP_MAXLEVEL];                      ///< skip list heads (level 0: free_list)
+  void *rover;                                         ///< start address of next-fit search
+  Slab *slab_list[SLAB_NCLASSES];                      ///< slabs with free slots, by class
+  uint64_t *slab_map;                                  ///< slab pages (bit i: page i is a slab)
+  size_t slab_npages;                                  ///< number of pages covered by slab_map
+  void *defer_bin[DEFER_NBINS];                        ///< deferred block headers, by size
+  int  defer_count[DEFER_NBINS];                       ///< number of blocks in each deferred bin
+  unsigned long ndeferred;                             ///< number of blocks in all deferred bins
+  unsigned long vcountdown;                            ///< operations until next sampled region
+  void *vcursor;                                       ///< free block (or heap_start) starting the
+                                                       ///< next region (NULL: pick a random one)
+  uint64_t vrand;                                      ///< random state for sampling
+} Arena;
+
+static Arena arenas[MAX_ARENAS];                       ///< arenas, one per data sub-segment
+static int  narenas        = 0;                        ///< number of arenas
+static size_t arena_stride = 0;                        ///< distance between sub-segment starts
+static unsigned int next_arena = 0;                    ///< round-robin arena assignment counter
+static size_t heap_bytes   = 0;                        ///< total size of all heaps (see mm_footprint())
+static void* bf_get_free_block_implicit(Arena *a, size_t size);
+static void* bf_get_free_block_explicit(Arena *a, size_t size);
+static void* sf_get_free_block_segregated(Arena *a, size_t size);
+static void* bf_get_free_block_tree(Arena *a, size_t size);
+static void* ff_get_free_block_ordered(Arena *a, size_t size);
+static void* nf_get_free_block_ordered(Arena *a, size_t size);
+
+#ifndef MM_POLICY
+static void *(*get_free_block)(Arena*, size_t) = NULL; ///< get free block for selected allocation policy
+#else
+/// @brief get free block for the policy fixed at compile time. A constant, so the compiler calls
+///        (and inlines) the search directly.
+static void *(*const get_free_block)(Arena*, size_t) =
+  (MM_POLICY) == fp_Implicit    ? bf_get_free_block_implicit :
+  (MM_POLICY) == fp_Explicit    ? bf_get_free_block_explicit :
+  (MM_POLICY) == fp_Segregated  ? sf_get_free_block_segregated :
+  (MM_POLICY) == fp_Tree        ? bf_get_free_block_tree :
+  (MM_POLICY) == fp_AddrOrdered ? ff_get_free_block_ordered :
+                                  nf_get_free_block_ordered;
+#endif
+
+static void* extend_heap(Arena *a, size_t words);
+static void* grow_heap(Arena *a, size_t size);
+static void* coalesce(Arena *a, void *bp);
+static int   shrink_heap(Arena *a, size_t pad);
+static void  defer_consolidate(Arena *a);
+static void  set_alloc(void *bp, size_t size);
+static void  set_free(void *bp, size_t size);
+static void  list_insert(Arena *a, void *bp);
+static void  list_remove(Arena *a, void *bp);
+static void  tree_insert(Arena *a, void *bp);
+static void  tree_remove(Arena *a, void *bp);
+static void  skip_insert(Arena *a, void *bp);
+static void  skip_remove(Arena *a, void *bp);
+static void  free_impl(void *ptr);
+
+#define LOCK(a)            TIMED(MM_LAT_LOCK, pthread_mutex_lock(&(a)->lock)) ///< acquire arena
+#define UNLOCK(a)          pthread_mutex_unlock(&(a)->lock) ///< release arena
+/// @}
+
+
+/// @name direct mappings
+/// @{
+#define MMAP_HDRSIZE       BS                          ///< default offset of payload in direct mapping
+#define ALIGN_OFS          BS                          ///< offset of aligned payload from header
+#define MMAP_SIZE(size)    ((MMAPTHLD > 0) && ((size) >= MMAPTHLD)) ///< request gets direct mapping
+
+static unsigned long mmap_count = 0;                   ///< number of live direct mappings
+static size_t mmap_bytes   = 0;                        ///< total size of live direct mappings
+/// @}
+
+
+/// @name thread caches
+/// @{
+#define TCACHE_MAXSIZE     512                         ///< largest block size held in thread caches
+#define TCACHE_NBINS       (TCACHE_MAXSIZE/BS)         ///< number of bins per thread cache
+
+/// @brief per-thread cache of small allocated blocks
+typedef struct TCache {
+  void *bin[TCACHE_NBINS];                             ///< cached block headers, by size
+  int  count[TCACHE_NBINS];                            ///< number of blocks in each bin
+  unsigned long generation;                            ///< heap generation the cache belongs to
+  Arena *arena;                                        ///< home arena of the thread
+  unsigned long nmalloc[MM_NCLASSES];                  ///< stats: malloc calls by size class
+  unsigned long nfree[MM_NCLASSES];                    ///< stats: free calls by size class
+#ifdef MM_TIMING
+  unsigned long lat[MM_NPHASES][MM_LAT_BUCKETS];        ///< stats: latency histograms by phase
+#endif
+  struct TCache *next;                                 ///< next registered cache
+} TCache;
+
+static pthread_key_t  tcache_key;                      ///< key to flush caches on thread exit
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT; ///< one-time creation of tcache_key
+static int  tcache_count   = 16;                       ///< max. blocks per bin (0: caches off)
+static unsigned long mm_generation = 0;                ///< incremented by every mm_init()
+static __thread TCache tcache;                         ///< this thread's cache
+static pthread_mutex_t tcache_lock = PTHREAD_MUTEX_INITIALIZER; ///< protects the following
+static TCache *tcache_list = NULL;                     ///< caches of the current generation
+static unsigned long retired_nmalloc[MM_NCLASSES];     ///< malloc calls of exited threads
+static unsigned long retired_nfree[MM_NCLASSES];       ///< free calls of exited threads
+#ifdef MM_TIMING
+static unsigned long retired_lat[MM_NPHASES][MM_LAT_BUCKETS]; ///< latencies of exited threads
+#endif
+/// @}
+
+
+/// @name allocation tracing
+/// @{
+#define TRACE_NRECS        (1 << 16)                   ///< records per thread ring buffer
+#define TRACE_INTERVAL     1000000                     ///< flusher sleep time when idle, in ns
+#ifndef MM_NOINSTR
+  #define TRACING          mm_tracing                  ///< tracing on
+#else
+  #define TRACING          0                           ///< tracing compiled out
+#endif
+
+/// @brief per-thread ring buffer of trace records. The owning thread is the only producer, the
+///        flusher thread the only consumer.
+typedef struct TraceBuf {
+  unsigned long head;                                  ///< next record to write (producer)
+  unsigned long dropped;                               ///< records dropped (buffer full)
+  unsigned long tail __attribute__((aligned(64)));     ///< next record to flush (consumer)
+  unsigned long session;                               ///< trace session of the buffer
+  unsigned int thread;                                 ///< thread index in the trace
+  int  orphaned;                                       ///< owning thread has exited
+  struct TraceBuf *next;                               ///< next buffer
+  struct mm_trace_rec rec[TRACE_NRECS];                ///< records
+} TraceBuf;
+
+static int  mm_tracing     = 0;                        ///< tracing on (yes: 1, no: 0)
+static __thread TraceBuf *trace_buf = NULL;            ///< this thread's trace buffer
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER; ///< protects the following
+static TraceBuf *trace_list = NULL;                    ///< all trace buffers
+static unsigned long trace_session = 0;                ///< incremented by every mm_trace_start()
+static unsigned int trace_nthreads = 0;                ///< threads recording in this session
+static FILE *trace_file    = NULL;                     ///< trace output
+static pthread_t trace_thread;                         ///< flusher thread
+static int  trace_stop     = 0;                        ///< flusher thread: terminate
 /// @}
 
 
@@ -183,6 +723,56 @@ static void mm_log(int level, ...)
 /// @}
 
 
+/// @name Latency instrumentation
+/// @{
+
+/// @brief get the histogram bucket of a latency of @a ns nanoseconds
+static inline int lat_bucket(uint64_t ns)
+{
+  if (ns < 16) return (int)ns;
+
+  int e = 63 - __builtin_clzl(ns);
+  int b = 16 + (e-4)*8 + (int)((ns >> (e-3)) & 7);
+
+  return MIN(b, MM_LAT_BUCKETS-1);
+}
+
+/// @brief TIMER_START(t) declares and starts timer @a t; TIMER_STOP(ph, t) counts the time
+///        elapsed since in this thread's histogram of phase @a ph. TIMED(ph, stmt) times the
+///        statement @a stmt. All of them cost nothing unless MM_TIMING is defined.
+#ifdef MM_TIMING
+  #define TIMER_START(t)       uint64_t t = timer_now()
+  #define TIMER_STOP(ph, t)    lat_record(ph, timer_now() - (t))
+
+static TCache* tcache_get(void);
+
+/// @brief get current time in nanoseconds
+static inline uint64_t timer_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/// @brief count a latency of @a ns nanoseconds in phase @a ph. Do not call directly; use
+///        TIMER_STOP() instead.
+static inline void lat_record(int ph, uint64_t ns)
+{
+  unsigned long *c = &tcache_get()->lat[ph][lat_bucket(ns)];
+
+  // single writer; readers in mm_getlatency() only need to see whole values
+  __atomic_store_n(c, *c + 1, __ATOMIC_RELAXED);
+}
+
+#else
+  #define TIMER_START(t)
+  #define TIMER_STOP(ph, t)
+#endif
+#define TIMED(ph, stmt)        do { TIMER_START(_t); stmt; TIMER_STOP(ph, _t); } while (0)
+
+/// @}
+
+
 /// @name Program termination facilities
 /// @{
 
@@ -211,17 +801,38 @@ static void mm_panic(const char *func, ...)
 /// @}
 
 
-static void* bf_get_free_block_implicit(size_t size);
-static void* bf_get_free_block_explicit(size_t size);
+static void  arena_init(Arena *a, int seg);
 
 void mm_init(FreelistPolicy fp)
 {
-  LOG(1, "mm_init()");
+  mm_init_ex(fp, 0);
+}
+
+
+/// @brief select block layout and free list policy
+/// @param fp free list policy
+/// @param options bitwise OR of mm_init_ex() options
+static void mm_configure(FreelistPolicy fp, int options)
+{
+  if (!MM_SUPPORTED(fp, options)) {
+    PANIC("Free list policy %d with options %x not supported by this build.", fp, options);
+  }
+
+  //
+  // set block layout
+  //
+#ifndef MM_OPTIONS
+  mm_footers = !(options & MM_NOFOOTER);
+  mm_slab    = !!(options & MM_SLAB);
+  mm_defer   = !!(options & MM_DEFER);
+#endif
 
   //
   // set free list policy
   //
+#ifndef MM_POLICY
   freelist_policy = fp;
+  mm_ordered = (fp == fp_AddrOrdered) || (fp == fp_NextFit);
   switch (freelist_policy)
   {
     case fp_Implicit:
@@ -231,371 +842,2905 @@ void mm_init(FreelistPolicy fp)
     case fp_Explicit:
       get_free_block = bf_get_free_block_explicit;
       break;
+
+    case fp_Segregated:
+      get_free_block = sf_get_free_block_segregated;
+      break;
+
+    case fp_Tree:
+      get_free_block = bf_get_free_block_tree;
+      break;
+
+    case fp_AddrOrdered:
+      get_free_block = ff_get_free_block_ordered;
+      break;
+
+    case fp_NextFit:
+      get_free_block = nf_get_free_block_ordered;
+      break;
     
     default:
       PANIC("Non supported freelist policy.");
       break;
   }
+#endif
+}
+
+
+void mm_init_ex(FreelistPolicy fp, int options)
+{
+  LOG(1, "mm_init_ex(%d, %x)", fp, options);
+
+  mm_configure(fp, options);
 
   //
-  // retrieve heap status and perform a few initial sanity checks
+  // retrieve data segment status and perform a few initial sanity checks
   //
-  ds_heap_stat(&ds_heap_start, &ds_heap_brk, NULL);
   PAGESIZE = ds_getpagesize();
+  narenas = ds_getnseg();
 
-  LOG(2, "  ds_heap_start:          %p\n"
-         "  ds_heap_brk:            %p\n"
-         "  PAGESIZE:               %d\n",
-         ds_heap_start, ds_heap_brk, PAGESIZE);
+  LOG(2, "  PAGESIZE:               %d\n"
+         "  arenas:                 %d\n",
+         PAGESIZE, narenas);
 
-  if (ds_heap_start == NULL) PANIC("Data segment not initialized.");
-  if (ds_heap_start != ds_heap_brk) PANIC("Heap not clean.");
+  if (narenas == 0) PANIC("Data segment not initialized.");
   if (PAGESIZE == 0) PANIC("Reported pagesize == 0.");
 
   //
-  // initialize heap
+  // initialize one heap per data sub-segment
   //
-  // TODO
-  size_t initial_heap_size = CHUNKSIZE;
-  void* new_heap_segment = ds_sbrk(initial_heap_size);
-  if (new_heap_segment == (void *)-1) {
-      PANIC("Failed to extend heap.");
-  }
+  heap_bytes = 0;
+  for (int i=0; i<narenas; i++) arena_init(&arenas[i], i);
 
-  heap_start = new_heap_segment + (4 * WSIZE);
-  heap_end = new_heap_segment + initial_heap_size - (2 * WSIZE);
+  arena_stride = narenas > 1 ? arenas[1].ds_heap_start - arenas[0].ds_heap_start : 0;
+  next_arena = 0;
 
-  PUT(heap_start - WSIZE, PACK(0, 1));
-  PUT(heap_start, PACK(0, 1));
-  PUT(heap_end, PACK(0, 1));
-  
-  size_t free_block_size = (heap_end - heap_start);
-  PUT(heap_start, PACK(free_block_size, 0));
-  PUT(heap_end - WSIZE, PACK(free_block_size, 0));
+  tcache_list = NULL;
+  memset(retired_nmalloc, 0, sizeof(retired_nmalloc));
+  memset(retired_nfree, 0, sizeof(retired_nfree));
+#ifdef MM_TIMING
+  memset(retired_lat, 0, sizeof(retired_lat));
+#endif
 
+  mm_generation++;
   mm_initialized = 1;
-    
 }
 
 
-/// @brief find and return a free block of at least @a size bytes (best fit)
-/// @param size size of block (including header & footer tags), in bytes
-/// @retval void* pointer to header of large enough free block
-/// @retval NULL if no free block of the requested size is avilable
-static void* bf_get_free_block_implicit(size_t size)
+/// @brief initialize arena @a a on data sub-segment @a seg
+/// @param a arena
+/// @param seg data sub-segment index
+static void arena_init(Arena *a, int seg)
 {
-  LOG(1, "bf_get_free_block_implicit(0x%lx (%lu))", size, size);
+  memset(a, 0, sizeof(*a));
+  pthread_mutex_init(&a->lock, NULL);
+  a->seg = seg;
 
-  assert(mm_initialized);
+  ds_heap_stat_seg(seg, &a->ds_heap_start, &a->ds_heap_brk, NULL);
 
-  //
-  // TODO
-  //
-  char *bp = heap_start;
-  while ((char *)bp < (char *)heap_end) {
-      size_t block_size = GET_SIZE(bp);
-      if (!GET_STATUS(bp) && (block_size >= size)) {
-          return bp;
-      }
-      char *next_bp = NEXT_PTR(bp + block_size);
-      if (next_bp >= (char *)heap_end) {
-          break;  // Prevent moving beyond heap end
-      }
-      bp = next_bp;
-  }
-  return NULL;
+  LOG(2, "  arena %d:\n"
+         "    ds_heap_start:        %p\n"
+         "    ds_heap_brk:          %p\n",
+         seg, a->ds_heap_start, a->ds_heap_brk);
+
+  if (a->ds_heap_start == NULL) PANIC("Data segment not initialized.");
+  if (a->ds_heap_start != a->ds_heap_brk) PANIC("Heap not clean.");
+
+  if (ds_sbrk_seg(seg, CHUNKSIZE) == (void*)-1) PANIC("Cannot initialize heap.");
+  ds_heap_stat_seg(seg, NULL, &a->ds_heap_brk, NULL);
+
+  a->heap_start = a->ds_heap_start + BS;
+  a->heap_end   = a->ds_heap_brk - BS;
+  a->chunksize  = CHUNKSIZE;
+  __atomic_add_fetch(&heap_bytes, a->heap_end - a->heap_start, __ATOMIC_RELAXED);
+  a->zero_start = a->heap_start;
+
+  PUT(PREV_PTR(a->heap_start), PACK(0, ALLOC));        // initial sentinel
+  PUT(a->heap_end, PACK(0, ALLOC));                    // end sentinel
+
+  // the whole heap is one free block
+  void *bp = a->heap_start;
+  PUT(bp, PACK(0, PREV_ALLOC));
+  set_free(bp, a->heap_end-a->heap_start);
+  list_insert(a, bp);
 }
 
 
-/// @brief find and return a free block of at least @a size bytes (best fit)
-/// @param size size of block (including header & footer tags), in bytes
-/// @retval void* pointer to header of large enough free block
-/// @retval NULL if no free block of the requested size is avilable
-static void* bf_get_free_block_explicit(size_t size)
+/// @brief get the arena owning block @a bp
+/// @param bp pointer to header of block
+/// @retval Arena* owning arena
+static Arena* arena_of(void *bp)
 {
-  LOG(1, "bf_get_free_block_explicit(0x%lx (%lu))", size, size);
+  if (narenas == 1) return &arenas[0];
+
+  size_t idx = (bp - arenas[0].ds_heap_start) / arena_stride;
+  return &arenas[idx < (size_t)narenas ? idx : (size_t)narenas-1];
+}
 
-  assert(mm_initialized);
-  
-  //
-  // TODO
-  //
-  char *bp = heap_start;
-  while (bp != NULL) {
-      size_t block_size = GET_SIZE(HDR2FTR(bp));
-      if (block_size >= size) {
-          return bp;
-      }
-      bp = NEXT_LIST_GET(bp);
-  }
-  return NULL;
 
+/// @brief mark block @a bp as allocated with @a size bytes. The PREV_ALLOC bit of @a bp is kept,
+///        the one of the next block is set. A footer is written only if mm_footers is on.
+/// @param bp pointer to header of block
+/// @param size block size in bytes
+static void set_alloc(void *bp, size_t size)
+{
+  PUT_SHARED(bp, PACK(size, ALLOC | GET_PREV_ALLOC(bp)));
+  if (mm_footers) PUT(HDR2FTR(bp), PACK(size, ALLOC));
+  PUT_SHARED(bp+size, GET(bp+size) | PREV_ALLOC);
 }
 
 
-void* mm_malloc(size_t size) {
-  LOG(1, "mm_malloc(0x%lx (%lu))", size, size);
-  assert(mm_initialized);
+/// @brief mark block @a bp as free with @a size bytes. The PREV_ALLOC bit of @a bp is kept,
+///        the one of the next block is cleared.
+/// @param bp pointer to header of block
+/// @param size block size in bytes
+static void set_free(void *bp, size_t size)
+{
+  PUT_SHARED(bp, PACK(size, FREE | GET_PREV_ALLOC(bp)));
+  PUT(HDR2FTR(bp), PACK(size, FREE));
+  PUT_SHARED(bp+size, GET(bp+size) & ~(TYPE)PREV_ALLOC);
+}
 
-  ///
-  /// TODO
-  ///
-  // 요청된 크기를 할당 가능한 최소 단위로 조정
-  size_t asize = size <= DSIZE ? 2 * DSIZE : DSIZE * ((size + (DSIZE) + (DSIZE - 1)) / DSIZE);
-
-  // 적절한 크기의 free block을 찾음
-  char *bp = get_free_block(asize);
-  if (bp != NULL) {
-      size_t actual_size = GET_SIZE(bp);
-      // 찾은 free block을 할당하기에 충분한 크기인지 확인
-      if (actual_size >= asize) {
-          // 남은 부분이 충분히 크면 분할하여 사용
-          if ((actual_size - asize) >= (2 * DSIZE)) {
-              // 할당된 부분 헤더와 풋터 설정
-              PUT(bp, PACK(asize, ALLOC));
-              PUT(HDR2FTR(bp), PACK(asize, ALLOC));
-              
-              // 남은 부분에 대한 헤더와 풋터 설정
-              bp = NEXT_PTR(bp + asize);
-              char *footer_pos = HDR2FTR(bp);
-              if ((char *)footer_pos < (char *)heap_end) {
-                  PUT(bp, PACK(actual_size - asize, FREE));
-                  PUT(footer_pos, PACK(actual_size - asize, FREE));
-              } else {
-                  // 주소가 힙의 끝을 넘어가면, 로그를 남기고 오류 처리
-                  LOG(1, "Attempting to write beyond heap end at %p", footer_pos);
-                  return NULL;
-              }
-          } else {
-              // 남은 부분이 충분히 크지 않으면 그대로 사용
-              PUT(bp, PACK(actual_size, ALLOC));
-              PUT(HDR2FTR(bp), PACK(actual_size, ALLOC));
-          }
-          // 할당된 메모리의 payload 주소 반환
-          return (void *)(bp + WSIZE);
-      }
-  }
 
-  // 적절한 free block을 찾지 못했을 경우 힙을 확장하여 새로운 free block 생성
-  size_t extendsize = MAX(asize, CHUNKSIZE);
-  bp = extend_heap(extendsize / WSIZE);
-  if (bp == NULL) {
-      return NULL;
-  }
+/// @brief compute the segregated size class of a block of @a size bytes
+/// @param size block size in bytes (multiple of BS)
+/// @retval int size class (0..NUM_CLASSES-1)
+static int size_class(size_t size)
+{
+  size_t n = size / BS;
+
+  if (n <= 8) return (int)n - 1;
 
-  // 새로운 free block에 대한 헤더와 풋터 설정
-  PUT(bp, PACK(asize, ALLOC));
-  PUT(HDR2FTR(bp), PACK(asize, ALLOC));
+  int fl = 63 - __builtin_clzl(n);
+  int idx = 8 + (fl-3)*4 + (int)((n >> (fl-2)) & 3);
 
-  // 할당된 메모리의 payload 주소 반환
-  return (void *)(bp + WSIZE);
+  return idx < NUM_CLASSES ? idx : NUM_CLASSES-1;
+}
 
 
+/// @brief get the head of the free list a free block of @a size bytes belongs to
+/// @param a arena
+/// @param size block size in bytes
+/// @retval void** pointer to list head
+static void** list_head(Arena *a, size_t size)
+{
+  if (freelist_policy == fp_Segregated) return &a->seg_list[size_class(size)];
+  else return &a->free_list;
 }
 
 
-static void* extend_heap(size_t words) {
-  char *bp;
-  size_t size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
-  if ((bp = ds_sbrk(size)) == (void *)-1) {
-      return NULL;
+/// @brief insert free block @a bp at the head of its free list (or at its position in the
+///        address-ordered list)
+/// @param a arena
+/// @param bp pointer to header of free block
+static void list_insert(Arena *a, void *bp)
+{
+  a->free_bytes += GET_SIZE(bp);
+  a->free_blocks++;
+  a->largest_free = MAX(a->largest_free, GET_SIZE(bp));
+  a->free_hist[size_class(GET_SIZE(bp))]++;
+
+  if (freelist_policy == fp_Implicit) return;
+  if ((freelist_policy == fp_Tree) && (GET_SIZE(bp) >= TREE_MINSIZE)) {
+    tree_insert(a, bp);
+    return;
   }
-
-  // 힙 확장에 성공하면 새로운 블록에 대한 헤더와 풋터 설정
-  PUT(HDR2FTR(bp), PACK(size, FREE));
-  PUT(FTR2HDR(bp + size - WSIZE), PACK(size, FREE));
-  
-  // 힙의 끝에 있는 블록의 풋터도 업데이트
-  PUT(HDR2FTR(bp + size), PACK(0, ALLOC));
-  return coalesce(bp);
-}
-
-static void* coalesce(void *bp) {
-  size_t prev_alloc = GET_STATUS(FTR2HDR(PREV_PTR(bp)));
-  size_t next_alloc = GET_STATUS(HDR2FTR(NEXT_PTR(bp)));
-  size_t size = GET_SIZE(HDR2FTR(bp));
-
-  if (prev_alloc && next_alloc) {
-      return bp;
-  } else if (prev_alloc && !next_alloc) {
-      size += GET_SIZE(HDR2FTR(NEXT_PTR(bp)));
-      PUT(HDR2FTR(bp), PACK(size, FREE));
-      PUT(FTR2HDR(bp + size - WSIZE), PACK(size, FREE));
-  } else if (!prev_alloc && next_alloc) {
-      size += GET_SIZE(HDR2FTR(PREV_PTR(bp)));
-      PUT(FTR2HDR(PREV_PTR(bp)), PACK(size, FREE));
-      PUT(HDR2FTR(bp), PACK(size, FREE));
-      bp = PREV_PTR(bp);
-  } else {
-      size += GET_SIZE(HDR2FTR(PREV_PTR(bp))) + GET_SIZE(HDR2FTR(NEXT_PTR(bp)));
-      PUT(FTR2HDR(PREV_PTR(bp)), PACK(size, FREE));
-      PUT(FTR2HDR(bp + size - WSIZE), PACK(size, FREE));
-      bp = PREV_PTR(bp);
+  if (mm_ordered) {
+    skip_insert(a, bp);
+    return;
   }
-  return bp;
+
+  void **head = list_head(a, GET_SIZE(bp));
+
+  NEXT_LIST_GET(bp) = *head;
+  PREV_LIST_GET(bp) = NULL;
+  if (*head != NULL) PREV_LIST_GET(*head) = bp;
+  *head = bp;
+
+  if (freelist_policy == fp_Segregated) a->seg_bitmap |= 1UL << size_class(GET_SIZE(bp));
 }
 
 
-void* mm_calloc(size_t nmemb, size_t size)
+/// @brief unlink free block @a bp from its free list. The size in the header of @a bp must
+///        still be the size @a bp was inserted with.
+/// @param a arena
+/// @param bp pointer to header of free block
+static void list_remove(Arena *a, void *bp)
 {
-  LOG(1, "mm_calloc(0x%lx, 0x%lx (%lu))", nmemb, size, size);
-
-  assert(mm_initialized);
+  a->free_bytes -= GET_SIZE(bp);
+  a->free_blocks--;
+  if (GET_SIZE(bp) == a->largest_free) a->largest_stale = 1;
+  a->free_hist[size_class(GET_SIZE(bp))]--;
+  if (bp == a->vcursor) a->vcursor = NULL;
+
+  if (freelist_policy == fp_Implicit) return;
+  if ((freelist_policy == fp_Tree) && (GET_SIZE(bp) >= TREE_MINSIZE)) {
+    tree_remove(a, bp);
+    return;
+  }
+  if (mm_ordered) {
+    skip_remove(a, bp);
+    return;
+  }
 
-  //
-  // calloc is simply malloc() followed by memset()
-  //
-  void *payload = mm_malloc(nmemb * size);
+  void **head = list_head(a, GET_SIZE(bp));
+  void *next = NEXT_LIST_GET(bp);
+  void *prev = PREV_LIST_GET(bp);
 
-  if (payload != NULL) memset(payload, 0, nmemb * size);
+  if (prev != NULL) NEXT_LIST_GET(prev) = next;
+  else *head = next;
+  if (next != NULL) PREV_LIST_GET(next) = prev;
 
-  return payload;
+  if ((freelist_policy == fp_Segregated) && (*head == NULL)) {
+    a->seg_bitmap &= ~(1UL << size_class(GET_SIZE(bp)));
+  }
 }
 
 
-void* mm_realloc(void *ptr, size_t size)
+/// @brief find and return a free block of at least @a size bytes (best fit)
+/// @param a arena
+/// @param size size of block (including header & footer tags), in bytes
+/// @retval void* pointer to header of large enough free block
+/// @retval NULL if no free block of the requested size is avilable
+static void* bf_get_free_block_implicit(Arena *a, size_t size)
 {
-  LOG(1, "mm_realloc(%p, 0x%lx (%lu))", ptr, size, size);
+  LOG(1, "bf_get_free_block_implicit(0x%lx (%lu))", size, size);
 
   assert(mm_initialized);
 
-  //
-  // TODO
-  //
-  /*
-  if (ptr == NULL) {
-    return mm_malloc(size);
+  void *bp = a->heap_start, *best = NULL;
+  while (bp < a->heap_end) {
+    size_t bsize = GET_SIZE(bp);
+    a->search_len++;
+    if ((GET_STATUS(bp) == FREE) && (bsize >= size)) {
+      if (bsize == size) return bp;
+      if ((best == NULL) || (bsize < GET_SIZE(best))) best = bp;
+    }
+    bp = bp + bsize;
   }
 
-  if (size == 0) {
-    mm_free(ptr);
-    return NULL;
-  }
+  return best;
+}
 
-  void *newptr = mm_malloc(size);
-  if (newptr == NULL) {
-    return NULL;
-  }
 
-  size_t oldsize = GET_SIZE(HDRP(ptr));
-  if (size < oldsize) oldsize = size;
-  memcpy(newptr, ptr, oldsize);
-  mm_free(ptr);
+/// @brief find and return a free block of at least @a size bytes (best fit)
+/// @param a arena
+/// @param size size of block (including header & footer tags), in bytes
+/// @retval void* pointer to header of large enough free block
+/// @retval NULL if no free block of the requested size is avilable
+static void* bf_get_free_block_explicit(Arena *a, size_t size)
+{
+  LOG(1, "bf_get_free_block_explicit(0x%lx (%lu))", size, size);
 
-  return newptr;  */
-  return NULL;
+  assert(mm_initialized);
+  
+  void *bp = a->free_list, *best = NULL;
+  while (bp != NULL) {
+    size_t bsize = GET_SIZE(bp);
+    a->search_len++;
+    if (bsize >= size) {
+      if (bsize == size) return bp;
+      if ((best == NULL) || (bsize < GET_SIZE(best))) best = bp;
+    }
+    bp = NEXT_LIST_GET(bp);
+  }
+
+  return best;
 }
 
 
-void mm_free(void *ptr)
+/// @brief find and return a free block of at least @a size bytes (segregated fit)
+/// @param a arena
+/// @param size size of block (including header & footer tags), in bytes
+/// @retval void* pointer to header of large enough free block
+/// @retval NULL if no free block of the requested size is avilable
+static void* sf_get_free_block_segregated(Arena *a, size_t size)
 {
-  LOG(1, "mm_free(%p)", ptr);
+  LOG(1, "sf_get_free_block_segregated(0x%lx (%lu))", size, size);
 
   assert(mm_initialized);
 
   //
-  // TODO
+  // search the list of the requested size class. Classes 0-7 hold a single size, so the head
+  // of a non-empty list always fits there.
+  //
+  int idx = size_class(size);
+  void *bp = a->seg_list[idx];
+  while (bp != NULL) {
+    a->search_len++;
+    if (GET_SIZE(bp) >= size) return bp;
+    bp = NEXT_LIST_GET(bp);
+  }
+
+  //
+  // any block in a larger class fits; take the head of the first non-empty one
   //
-  /*
-  size_t size = GET_SIZE(HDRP(ptr));
-  PUT(HDRP(ptr), PACK(size, 0));
-  PUT(FTRP(ptr), PACK(size, 0));
-  coalesce(ptr);
-    */
+  uint64_t larger = idx+1 < NUM_CLASSES ? a->seg_bitmap & (~0UL << (idx+1)) : 0;
+  if (larger != 0) {
+    a->search_len++;
+    return a->seg_list[__builtin_ctzl(larger)];
+  }
+
   return NULL;
 }
 
 
-void mm_setloglevel(int level)
+/// @brief rotate subtree @a t to the right (left child becomes root)
+/// @param t root of subtree
+/// @retval void* new root of subtree
+static void* tree_rotate_right(void *t)
 {
-  mm_loglevel = level;
+  void *l = LEFT_TREE_GET(t);
+  LEFT_TREE_GET(t) = RIGHT_TREE_GET(l);
+  RIGHT_TREE_GET(l) = t;
+  return l;
 }
 
 
-void mm_check(void)
+/// @brief rotate subtree @a t to the left (right child becomes root)
+/// @param t root of subtree
+/// @retval void* new root of subtree
+static void* tree_rotate_left(void *t)
 {
-  assert(mm_initialized);
-
-  void *p;
+  void *r = RIGHT_TREE_GET(t);
+  RIGHT_TREE_GET(t) = LEFT_TREE_GET(r);
+  LEFT_TREE_GET(r) = t;
+  return r;
+}
 
-  char *fpstr;
-  if (freelist_policy == fp_Implicit) fpstr = "Implicit";
-  else if (freelist_policy == fp_Explicit) fpstr = "Explicit";
-  else fpstr = "invalid";
 
-  printf("----------------------------------------- mm_check ----------------------------------------------\n");
-  printf("  ds_heap_start:          %p\n", ds_heap_start);
-  printf("  ds_heap_brk:            %p\n", ds_heap_brk);
-  printf("  heap_start:             %p\n", heap_start);
-  printf("  heap_end:               %p\n", heap_end);
-  printf("  free list policy:       %s\n", fpstr);
+/// @brief insert free block @a bp into subtree @a t. Blocks of a size already present in the
+///        tree are chained off the existing node.
+/// @param t root of subtree (may be NULL)
+/// @param bp pointer to header of free block
+/// @retval void* new root of subtree
+static void* tree_insert_at(void *t, void *bp)
+{
+  if (t == NULL) {
+    NEXT_LIST_GET(bp) = PREV_LIST_GET(bp) = NULL;
+    LEFT_TREE_GET(bp) = RIGHT_TREE_GET(bp) = NULL;
+    PRIO_TREE_GET(bp) = (WORD(bp) >> 5) * 0x9e3779b97f4a7c15UL;
+    return bp;
+  }
 
-  printf("\n");
-  p = PREV_PTR(heap_start);
-  printf("  initial sentinel:       %p: size: %6lx (%7ld), status: %s\n",
-         p, GET_SIZE(p), GET_SIZE(p), GET_STATUS(p) == ALLOC ? "allocated" : "free");
-  p = heap_end;
-  printf("  end sentinel:           %p: size: %6lx (%7ld), status: %s\n",
-         p, GET_SIZE(p), GET_SIZE(p), GET_STATUS(p) == ALLOC ? "allocated" : "free");
-  printf("\n");
+  size_t size = GET_SIZE(bp), tsize = GET_SIZE(t);
 
-  if(freelist_policy == fp_Implicit){
-    printf("    %-14s  %8s  %10s  %10s  %8s  %s\n", "address", "offset", "size (hex)", "size (dec)", "payload", "status");
+  if (size == tsize) {
+    NEXT_LIST_GET(bp) = NEXT_LIST_GET(t);
+    PREV_LIST_GET(bp) = t;
+    if (NEXT_LIST_GET(t) != NULL) PREV_LIST_GET(NEXT_LIST_GET(t)) = bp;
+    NEXT_LIST_GET(t) = bp;
+  } else if (size < tsize) {
+    LEFT_TREE_GET(t) = tree_insert_at(LEFT_TREE_GET(t), bp);
+    if (PRIO_TREE_GET(LEFT_TREE_GET(t)) > PRIO_TREE_GET(t)) t = tree_rotate_right(t);
+  } else {
+    RIGHT_TREE_GET(t) = tree_insert_at(RIGHT_TREE_GET(t), bp);
+    if (PRIO_TREE_GET(RIGHT_TREE_GET(t)) > PRIO_TREE_GET(t)) t = tree_rotate_left(t);
   }
-  else if(freelist_policy == fp_Explicit){
-    printf("    %-14s  %8s  %10s  %10s  %8s  %-14s  %-14s  %s\n", "address", "offset", "size (hex)", "size (dec)", "payload", "next", "prev", "status");
+
+  return t;
+}
+
+
+/// @brief merge subtrees @a a and @a b. All keys in @a a must be smaller than those in @a b.
+/// @param a left subtree (may be NULL)
+/// @param b right subtree (may be NULL)
+/// @retval void* root of merged subtree
+static void* tree_merge(void *a, void *b)
+{
+  if (a == NULL) return b;
+  if (b == NULL) return a;
+
+  if (PRIO_TREE_GET(a) > PRIO_TREE_GET(b)) {
+    RIGHT_TREE_GET(a) = tree_merge(RIGHT_TREE_GET(a), b);
+    return a;
+  } else {
+    LEFT_TREE_GET(b) = tree_merge(a, LEFT_TREE_GET(b));
+    return b;
+  }
+}
+
+
+/// @brief find the link (root pointer or child pointer) that points to tree node @a bp
+/// @param a arena
+/// @param bp pointer to header of tree node
+/// @retval void** pointer to link
+static void** tree_link(Arena *a, void *bp)
+{
+  size_t size = GET_SIZE(bp);
+  void **link = &a->tree_root;
+
+  while (*link != bp) {
+    assert(*link != NULL);
+    link = size < GET_SIZE(*link) ? &LEFT_TREE_GET(*link) : &RIGHT_TREE_GET(*link);
+  }
+
+  return link;
+}
+
+
+/// @brief insert free block @a bp into the size-ordered free tree
+/// @param a arena
+/// @param bp pointer to header of free block
+static void tree_insert(Arena *a, void *bp)
+{
+  a->tree_root = tree_insert_at(a->tree_root, bp);
+}
+
+
+/// @brief remove free block @a bp from the size-ordered free tree. Chained blocks are unlinked
+///        in O(1). A tree node is replaced by its first chained block if there is one, otherwise
+///        its subtrees are merged.
+/// @param a arena
+/// @param bp pointer to header of free block
+static void tree_remove(Arena *a, void *bp)
+{
+  void *next = NEXT_LIST_GET(bp);
+  void *prev = PREV_LIST_GET(bp);
+
+  if (prev != NULL) {
+    NEXT_LIST_GET(prev) = next;
+    if (next != NULL) PREV_LIST_GET(next) = prev;
+    return;
+  }
+
+  void **link = tree_link(a, bp);
+  if (next != NULL) {
+    LEFT_TREE_GET(next) = LEFT_TREE_GET(bp);
+    RIGHT_TREE_GET(next) = RIGHT_TREE_GET(bp);
+    PRIO_TREE_GET(next) = PRIO_TREE_GET(bp);
+    PREV_LIST_GET(next) = NULL;
+    *link = next;
+  } else {
+    *link = tree_merge(LEFT_TREE_GET(bp), RIGHT_TREE_GET(bp));
+  }
+}
+
+
+/// @brief find and return a free block of at least @a size bytes (best fit)
+/// @param a arena
+/// @param size size of block (including header & footer tags), in bytes
+/// @retval void* pointer to header of large enough free block
+/// @retval NULL if no free block of the requested size is avilable
+static void* bf_get_free_block_tree(Arena *a, size_t size)
+{
+  LOG(1, "bf_get_free_block_tree(0x%lx (%lu))", size, size);
+
+  assert(mm_initialized);
+
+  if ((size < TREE_MINSIZE) && (a->free_list != NULL)) {
+    a->search_len++;
+    return a->free_list;
+  }
+
+  void *t = a->tree_root, *best = NULL;
+  while (t != NULL) {
+    size_t tsize = GET_SIZE(t);
+    a->search_len++;
+    if (tsize == size) {
+      best = t;
+      break;
+    }
+    if (tsize > size) {
+      best = t;
+      t = LEFT_TREE_GET(t);
+    } else {
+      t = RIGHT_TREE_GET(t);
+    }
+  }
+
+  // prefer a chained block; it can be removed without restructuring the tree
+  if ((best != NULL) && (NEXT_LIST_GET(best) != NULL)) best = NEXT_LIST_GET(best);
+
+  return best;
+}
+
+
+/// @brief get the skip list height of free block @a bp. Derived from the address; a block has
+///        at least one level and at most as many as fit in front of its footer.
+/// @param bp pointer to header of free block
+/// @retval int number of levels (1..SKIP_MAXLEVEL)
+static int skip_height(void *bp)
+{
+  uint64_t h = (WORD(bp) * 0x9e3779b97f4a7c15UL) >> 32;
+  int levels = 1 + __builtin_ctzl(h | (1UL << 31)) / 2;
+  int fit = GET_SIZE(bp)/WSIZE - 3;
+
+  return MIN(levels, MIN(fit, SKIP_MAXLEVEL));
+}
+
+
+/// @brief get the forward link on level @a l of skip list node @a x
+/// @param a arena
+/// @param x pointer to header of free block (NULL: list head)
+/// @param l level
+/// @retval void** pointer to link
+static inline void** skip_next(Arena *a, void *x, int l)
+{
+  if (x == NULL) return l == 0 ? &a->free_list : &a->skip_head[l];
+  else return l == 0 ? &NEXT_LIST_GET(x) : &SKIP_LINK(x, l);
+}
+
+
+/// @brief get the last free block below address @a p in the address-ordered list
+/// @param a arena
+/// @param p address
+/// @param[out] pred if not NULL, the last nodes below @a p on every level (NULL: list head)
+/// @retval void* pointer to header of free block (NULL if there is none)
+static void* skip_find(Arena *a, void *p, void *pred[SKIP_MAXLEVEL])
+{
+  void *x = NULL, *n;
+
+  for (int l=SKIP_MAXLEVEL-1; l>=0; l--) {
+    while (((n = *skip_next(a, x, l)) != NULL) && (n < p)) x = n;
+    if (pred != NULL) pred[l] = x;
+  }
+
+  return x;
+}
+
+
+/// @brief insert free block @a bp into the address-ordered list of arena @a a in O(log n)
+/// @param a arena
+/// @param bp pointer to header of free block
+static void skip_insert(Arena *a, void *bp)
+{
+  void *pred[SKIP_MAXLEVEL];
+  int h = skip_height(bp);
+
+  void *prev = skip_find(a, bp, pred);
+  void *next = *skip_next(a, prev, 0);
+
+  NEXT_LIST_GET(bp) = next;
+  PREV_LIST_GET(bp) = prev;
+  *skip_next(a, prev, 0) = bp;
+  if (next != NULL) PREV_LIST_GET(next) = bp;
+
+  for (int l=1; l<h; l++) {
+    SKIP_LINK(bp, l) = *skip_next(a, pred[l], l);
+    *skip_next(a, pred[l], l) = bp;
+  }
+}
+
+
+/// @brief remove free block @a bp from the address-ordered list of arena @a a. O(1) for blocks
+///        on level 0 only, O(log n) otherwise.
+/// @param a arena
+/// @param bp pointer to header of free block
+static void skip_remove(Arena *a, void *bp)
+{
+  int h = skip_height(bp);
+
+  if (h > 1) {
+    void *pred[SKIP_MAXLEVEL];
+    skip_find(a, bp, pred);
+    for (int l=1; l<h; l++) *skip_next(a, pred[l], l) = SKIP_LINK(bp, l);
+  }
+
+  void *next = NEXT_LIST_GET(bp);
+  void *prev = PREV_LIST_GET(bp);
+
+  *skip_next(a, prev, 0) = next;
+  if (next != NULL) PREV_LIST_GET(next) = prev;
+}
+
+
+/// @brief find and return the free block of at least @a size bytes with the lowest address
+///        (address-ordered first fit)
+/// @param a arena
+/// @param size size of block (including header & footer tags), in bytes
+/// @retval void* pointer to header of large enough free block
+/// @retval NULL if no free block of the requested size is avilable
+static void* ff_get_free_block_ordered(Arena *a, size_t size)
+{
+  LOG(1, "ff_get_free_block_ordered(0x%lx (%lu))", size, size);
+
+  assert(mm_initialized);
+
+  // largest_free is an upper bound; failing searches need not walk the list
+  if (size > a->largest_free) return NULL;
+
+  for (void *bp = a->free_list; bp != NULL; bp = NEXT_LIST_GET(bp)) {
+    a->search_len++;
+    if (GET_SIZE(bp) >= size) return bp;
+  }
+
+  return NULL;
+}
+
+
+/// @brief find and return the first free block of at least @a size bytes at or above the roving
+///        pointer, wrapping around to the start of the heap (next fit). The free block at the top
+///        of the heap is the last resort. The roving pointer is advanced to the block found.
+/// @param a arena
+/// @param size size of block (including header & footer tags), in bytes
+/// @retval void* pointer to header of large enough free block
+/// @retval NULL if no free block of the requested size is avilable
+static void* nf_get_free_block_ordered(Arena *a, size_t size)
+{
+  LOG(1, "nf_get_free_block_ordered(0x%lx (%lu))", size, size);
+
+  assert(mm_initialized);
+
+  if (size > a->largest_free) return NULL;
+
+  void *start = *skip_next(a, skip_find(a, a->rover, NULL), 0);
+  void *top = GET_PREV_ALLOC(a->heap_end) ? NULL : PREV_BLK(a->heap_end);
+
+  for (void *bp = start; bp != NULL; bp = NEXT_LIST_GET(bp)) {
+    a->search_len++;
+    if ((bp != top) && (GET_SIZE(bp) >= size)) return a->rover = bp;
+  }
+  for (void *bp = a->free_list; bp != start; bp = NEXT_LIST_GET(bp)) {
+    a->search_len++;
+    if ((bp != top) && (GET_SIZE(bp) >= size)) return a->rover = bp;
+  }
+  if ((top != NULL) && (GET_SIZE(top) >= size)) return a->rover = top;
+
+  return NULL;
+}
+
+
+/// @brief get a free block of at least @a size bytes with the selected allocation policy and
+///        record the search length
+/// @param a arena
+/// @param size size of block (including header & footer tags), in bytes
+/// @retval void* pointer to header of large enough free block
+/// @retval NULL if no free block of the requested size is avilable
+static void* find_free_block(Arena *a, size_t size)
+{
+  a->search_len = 0;
+  void *bp;
+  TIMED(MM_LAT_SEARCH, bp = get_free_block(a, size));
+
+  unsigned long n = a->search_len;
+  a->search_hist[n == 0 ? 0 : MIN(64 - __builtin_clzl(n), MM_NSEARCH-1)]++;
+
+  return bp;
+}
+
+
+/// @name validation
+/// @{
+#define VALIDATE_SPAN      64                          ///< blocks per sampled region
+/// @}
+
+/// @brief check whether @a p can be a block header of arena @a a (NULL is accepted)
+#define VALID_LINK(a, p) \
+  (((p) == NULL) || (((p) >= (a)->heap_start) && ((p) < (a)->heap_end) && (WORD(p) % BS == 0)))
+
+
+/// @brief check the upper-level links of free block @a bp in the address-ordered list
+/// @param a arena
+/// @param bp pointer to header of free block
+/// @retval int 1 if all links are plausible, 0 otherwise
+static int skip_valid(Arena *a, void *bp)
+{
+  for (int l=1; l<skip_height(bp); l++) {
+    void *n = SKIP_LINK(bp, l);
+    if (!VALID_LINK(a, n) || ((n != NULL) && (n <= bp))) return 0;
+  }
+
+  return 1;
+}
+
+
+/// @brief verify the boundary tags and free list links of block @a bp and its relation to its
+///        neighbours. Terminates the process on errors.
+/// @param a arena
+/// @param bp pointer to header of block
+static void validate_block(Arena *a, void *bp)
+{
+  TYPE hdr = GET(bp);
+  size_t size = SIZE(hdr);
+  void *next = bp + size;
+  const char *err = NULL;
+
+  if ((bp < a->heap_start) || (size == 0) || (size % BS != 0) || (next > a->heap_end)) {
+    err = "invalid size";
+  } else if ((mm_footers || (STATUS(hdr) == FREE)) && (GET(HDR2FTR(bp)) != PACK(size, STATUS(hdr)))) {
+    err = "header/footer mismatch";
+  } else if (!GET_PREV_ALLOC(next) != (STATUS(hdr) == FREE)) {
+    err = "prev bit of next block wrong";
+  } else if (!GET_PREV_ALLOC(bp) && ((STATUS(GET(PREV_PTR(bp))) != FREE) ||
+             (PREV_BLK(bp) < a->heap_start) || (GET_STATUS(PREV_BLK(bp)) != FREE) ||
+             (GET_SIZE(PREV_BLK(bp)) != GET_SIZE(PREV_PTR(bp))))) {
+    err = "footer of free predecessor invalid";
+  } else if ((STATUS(hdr) == FREE) && (!GET_PREV_ALLOC(bp) || (GET_STATUS(next) == FREE))) {
+    err = "free block not coalesced";
+  } else if ((STATUS(hdr) == FREE) && (freelist_policy != fp_Implicit)) {
+    void *nb = NEXT_LIST_GET(bp);
+    void *pb = PREV_LIST_GET(bp);
+    int node = (freelist_policy == fp_Tree) && (size >= TREE_MINSIZE) && (pb == NULL);
+
+    if (!VALID_LINK(a, nb) || !VALID_LINK(a, pb)) err = "link outside of heap";
+    else if ((nb != NULL) && (PREV_LIST_GET(nb) != bp)) err = "next link not symmetric";
+    else if ((pb != NULL) && (NEXT_LIST_GET(pb) != bp)) err = "prev link not symmetric";
+    else if ((pb == NULL) && !node && (*list_head(a, size) != bp)) err = "not at head of list";
+    else if (mm_ordered && (nb != NULL) && (nb <= bp)) err = "address order violated";
+    else if (mm_ordered && !skip_valid(a, bp)) err = "skip link invalid";
+    else if (node) {
+      void *l = LEFT_TREE_GET(bp), *r = RIGHT_TREE_GET(bp);
+      if (!VALID_LINK(a, l) || !VALID_LINK(a, r)) err = "link outside of heap";
+      else if (((l != NULL) && ((GET_SIZE(l) >= size) || (PRIO_TREE_GET(l) > PRIO_TREE_GET(bp)))) ||
+          ((r != NULL) && ((GET_SIZE(r) <= size) || (PRIO_TREE_GET(r) > PRIO_TREE_GET(bp))))) {
+        err = "tree order violated";
+      }
+    }
+  }
+
+  if (err != NULL) PANIC("Heap corruption in block %p (header 0x%lx): %s.", bp, hdr, err);
+}
+
+
+#ifndef MM_NOINSTR
+/// @brief get a random number from the sampling generator of arena @a a (xorshift64)
+/// @param a arena
+/// @retval uint64_t random number
+static uint64_t validate_rand(Arena *a)
+{
+  uint64_t x = a->vrand != 0 ? a->vrand : WORD(a) | 1;
+
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+
+  return a->vrand = x;
+}
+
+
+/// @brief pick a random free block of arena @a a
+/// @param a arena
+/// @retval void* pointer to header of free block (or of the first block for fp_Implicit)
+/// @retval NULL if none was found
+static void* validate_pick(Arena *a)
+{
+  uint64_t r = validate_rand(a);
+  void *bp = NULL;
+
+  switch (freelist_policy) {
+    case fp_Implicit:
+      bp = a->heap_start;
+      break;
+
+    case fp_Explicit:
+      bp = a->free_list;
+      break;
+
+    case fp_Segregated:
+      // uniformly among the non-empty lists
+      if (a->seg_bitmap != 0) {
+        uint64_t m = a->seg_bitmap;
+        for (int k = r % __builtin_popcountl(m); k > 0; k--) m &= m-1;
+        bp = a->seg_list[__builtin_ctzl(m)];
+      }
+      break;
+
+    case fp_Tree:
+      // random descent; every step continues with probability 3/4
+      for (void *t = a->tree_root; (t != NULL) && VALID_LINK(a, t) && (r != 0); r >>= 2) {
+        bp = t;
+        if ((r & 3) == 0) break;
+        t = r & 1 ? LEFT_TREE_GET(t) : RIGHT_TREE_GET(t);
+      }
+      if (bp == NULL) bp = a->free_list;
+      break;
+
+    case fp_AddrOrdered:
+    case fp_NextFit:
+      // random walk down the skip list, 0-3 steps per level
+      for (int l=SKIP_MAXLEVEL-1; l>=0; l--, r >>= 2) {
+        for (int k = r & 3; k > 0; k--) {
+          void *n = *skip_next(a, bp, l);
+          if ((n == NULL) || !VALID_LINK(a, n)) break;
+          bp = n;
+        }
+      }
+      if (bp == NULL) bp = a->free_list;
+      break;
+  }
+
+  return bp;
+}
+#endif
+
+
+/// @brief validation hook for heap operations of arena @a a that produced block @a bp. Performs
+///        the local checks and, when due, verifies a sampled region. Must be called with the
+///        arena lock held.
+/// @param a arena
+/// @param bp pointer to header of block
+static void validate_op(Arena *a, void *bp)
+{
+  if (mm_validate) validate_block(a, bp);
+
+#ifndef MM_NOINSTR
+  if ((VALIDATEPERIOD == 0) || (a->vcountdown-- > 0)) return;
+  a->vcountdown = validate_rand(a) % (2*VALIDATEPERIOD);
+
+  void *start = a->vcursor != NULL ? a->vcursor : validate_pick(a);
+  if (start == NULL) start = bp;
+
+  // walk VALIDATE_SPAN blocks, then on to the next free block (at most VALIDATE_SPAN more)
+  void *p = start;
+  a->vcursor = NULL;
+  for (int i=0; i<2*VALIDATE_SPAN; i++, p = NEXT_BLK(p)) {
+    if (p >= a->heap_end) {
+      a->vcursor = a->heap_start;
+      break;
+    }
+    if ((i >= VALIDATE_SPAN) && (GET_STATUS(p) == FREE)) {
+      a->vcursor = p;
+      break;
+    }
+    validate_block(a, p);
+  }
+
+  if ((freelist_policy != fp_Implicit) && (GET_STATUS(start) == FREE)) {
+    p = NEXT_LIST_GET(start);
+    for (int i=0; (i<VALIDATE_SPAN) && (p != NULL); i++, p = NEXT_LIST_GET(p)) validate_block(a, p);
+  }
+#endif
+}
+
+
+/// @brief allocate @a asize bytes from free block @a bp and split off the remainder if it is
+///        large enough to form a block of its own.
+/// @param a arena
+/// @param bp pointer to header of free block
+/// @param asize block size (including header & footer tags), in bytes
+static void place(Arena *a, void *bp, size_t asize)
+{
+  TIMER_START(t);
+  size_t size = GET_SIZE(bp);
+
+  list_remove(a, bp);
+
+  if (size - asize >= BS) {
+    set_alloc(bp, asize);
+
+    void *rp = NEXT_BLK(bp);
+    set_free(rp, size-asize);
+    list_insert(a, rp);
+    if (mm_validate) validate_block(a, rp);
+  } else {
+    set_alloc(bp, size);
+  }
+
+  a->zero_start = MAX(a->zero_start, NEXT_BLK(bp));
+  a->inuse_blocks++;
+
+  validate_op(a, bp);
+  TIMER_STOP(MM_LAT_SPLIT, t);
+}
+
+
+/// @brief allocate a block of @a asize bytes from arena @a a. Must be called with the arena
+///        lock held.
+/// @param a arena
+/// @param asize block size (including header & footer tags), in bytes
+/// @retval void* pointer to header of allocated block
+/// @retval NULL if the heap could not be extended
+static void* heap_malloc(Arena *a, size_t asize)
+{
+  void *bp;
+
+  if ((asize <= DEFER_MAXSIZE) && ((bp = a->defer_bin[asize/BS - 1]) != NULL)) {
+    int idx = asize/BS - 1;
+    a->defer_bin[idx] = NEXT_LIST_GET(bp);
+    a->defer_count[idx]--;
+    a->ndeferred--;
+    return bp;
+  }
+
+  bp = find_free_block(a, asize);
+  if ((bp == NULL) && (a->ndeferred > 0)) {
+    defer_consolidate(a);
+    bp = find_free_block(a, asize);
+  }
+  if (bp == NULL) {
+    bp = grow_heap(a, asize);
+    if (bp == NULL) return NULL;
+  }
+
+  place(a, bp, asize);
+
+  return bp;
+}
+
+
+/// @brief allocate a block of @a asize bytes from arena @a a such that header + @a ofs is aligned
+///        to @a align bytes. The part of the free block in front of the header is split off and
+///        remains free. Must be called with the arena lock held.
+/// @param a arena
+/// @param asize block size (including header & footer tags), in bytes
+/// @param align alignment (power of 2, multiple of BS)
+/// @param ofs offset of the aligned address from the header (multiple of BS)
+/// @retval void* pointer to header of allocated block
+/// @retval NULL if the heap could not be extended
+static void* heap_malloc_aligned(Arena *a, size_t asize, size_t align, size_t ofs)
+{
+  // headers are BS-aligned, so the header is at most align-BS bytes into the block
+  size_t req = asize + align - BS;
+
+  void *bp = find_free_block(a, req);
+  if ((bp == NULL) && (a->ndeferred > 0)) {
+    defer_consolidate(a);
+    bp = find_free_block(a, req);
+  }
+  if (bp == NULL) {
+    bp = grow_heap(a, req);
+    if (bp == NULL) return NULL;
+  }
+
+  void *hp = PTR(((WORD(bp) + ofs + align-1) & ~(TYPE)(align-1)) - ofs);
+  if (hp != bp) {
+    size_t size = GET_SIZE(bp);
+
+    list_remove(a, bp);
+    set_free(bp, hp-bp);
+    list_insert(a, bp);
+
+    PUT(hp, PACK(0, FREE));
+    set_free(hp, size-(hp-bp));
+    list_insert(a, hp);
+  }
+
+  place(a, hp, asize);
+
+  return hp;
+}
+
+
+/// @brief release allocated block @a bp to arena @a a and coalesce it with its free neighbours in
+///        O(1). Shrinks the heap if the top free block grows too large. Must be called with the
+///        arena lock held.
+/// @param a arena owning @a bp
+/// @param bp pointer to header of allocated block
+static void heap_release(Arena *a, void *bp)
+{
+  set_free(bp, GET_SIZE(bp));
+  a->inuse_blocks--;
+
+  bp = coalesce(a, bp);
+  if ((NEXT_BLK(bp) == a->heap_end) && (GET_SIZE(bp) > a->chunksize + SHRINKTHLD)) {
+    shrink_heap(a, a->chunksize);
+  }
+}
+
+
+/// @brief release all blocks in the deferred bins of arena @a a. Must be called with the arena
+///        lock held.
+/// @param a arena
+static void defer_consolidate(Arena *a)
+{
+  LOG(2, "  defer_consolidate(%d): %lu blocks", a->seg, a->ndeferred);
+
+  for (int idx=0; idx<DEFER_NBINS; idx++) {
+    void *bp = a->defer_bin[idx];
+    while (bp != NULL) {
+      void *next = NEXT_LIST_GET(bp);
+      heap_release(a, bp);
+      bp = next;
+    }
+    a->defer_bin[idx] = NULL;
+    a->defer_count[idx] = 0;
+  }
+  a->ndeferred = 0;
+}
+
+
+/// @brief return allocated block @a bp to arena @a a. With deferred coalescing, small blocks are
+///        put into the arena's deferred bins (consolidating them if the bin is full); all others
+///        are released immediately. Must be called with the arena lock held.
+/// @param a arena owning @a bp
+/// @param bp pointer to header of allocated block
+static void heap_free(Arena *a, void *bp)
+{
+  size_t size = GET_SIZE(bp);
+
+  if (!mm_defer || (size > DEFER_MAXSIZE)) {
+    heap_release(a, bp);
+    return;
+  }
+
+  int idx = size/BS - 1;
+  if (a->defer_count[idx] >= DEFER_COUNT) defer_consolidate(a);
+
+  NEXT_LIST_GET(bp) = a->defer_bin[idx];
+  a->defer_bin[idx] = bp;
+  a->defer_count[idx]++;
+  a->ndeferred++;
+}
+
+
+/// @brief allocate a block of @a asize bytes from arena @a a. Other arenas are tried if @a a
+///        is exhausted.
+/// @param a preferred arena
+/// @param asize block size (including header & footer tags), in bytes
+/// @retval void* pointer to header of allocated block
+/// @retval NULL if no arena could provide a block
+static void* arena_malloc(Arena *a, size_t asize)
+{
+  for (int i=0; i<narenas; i++) {
+    LOCK(a);
+    void *bp = heap_malloc(a, asize);
+    UNLOCK(a);
+
+    if (bp != NULL) return bp;
+
+    a = &arenas[(a - arenas + 1) % narenas];
+  }
+
+  return NULL;
+}
+
+
+/// @brief flush the first @a n blocks of bin @a idx of @a tc to their arenas
+/// @param tc thread cache
+/// @param idx bin index
+/// @param n number of blocks to flush
+static void tcache_flush(TCache *tc, int idx, int n)
+{
+  Arena *locked = NULL;
+
+  while ((n-- > 0) && (tc->bin[idx] != NULL)) {
+    void *bp = tc->bin[idx];
+    tc->bin[idx] = NEXT_LIST_GET(bp);
+    tc->count[idx]--;
+
+    Arena *a = arena_of(bp);
+    if (a != locked) {
+      if (locked != NULL) UNLOCK(locked);
+      LOCK(a);
+      locked = a;
+    }
+    heap_free(a, bp);
+  }
+
+  if (locked != NULL) UNLOCK(locked);
+}
+
+
+/// @brief thread exit handler: flush the entire cache of the exiting thread
+/// @param arg thread cache
+static void tcache_destroy(void *arg)
+{
+  TCache *tc = arg;
+
+  if (trace_buf != NULL) __atomic_store_n(&trace_buf->orphaned, 1, __ATOMIC_RELEASE);
+
+  if (tc->generation != mm_generation) return;
+  for (int idx=0; idx<TCACHE_NBINS; idx++) tcache_flush(tc, idx, tc->count[idx]);
+
+  // keep the statistics of the thread and unregister its cache
+  pthread_mutex_lock(&tcache_lock);
+  for (int i=0; i<MM_NCLASSES; i++) {
+    retired_nmalloc[i] += tc->nmalloc[i];
+    retired_nfree[i] += tc->nfree[i];
+  }
+#ifdef MM_TIMING
+  for (int ph=0; ph<MM_NPHASES; ph++) {
+    for (int b=0; b<MM_LAT_BUCKETS; b++) retired_lat[ph][b] += tc->lat[ph][b];
+  }
+#endif
+  TCache **link = &tcache_list;
+  while ((*link != NULL) && (*link != tc)) link = &(*link)->next;
+  if (*link != NULL) *link = tc->next;
+  pthread_mutex_unlock(&tcache_lock);
+}
+
+
+/// @brief create the key used to flush thread caches on thread exit
+static void tcache_createkey(void)
+{
+  if (pthread_key_create(&tcache_key, tcache_destroy) != 0) PANIC("Cannot create tcache key.");
+}
+
+
+/// @brief get this thread's cache. Caches from a previous heap generation are discarded and the
+///        thread is assigned a (new) home arena.
+/// @retval TCache* this thread's cache
+static TCache* tcache_get(void)
+{
+  TCache *tc = &tcache;
+
+  if (tc->generation != mm_generation) {
+    pthread_once(&tcache_once, tcache_createkey);
+    pthread_setspecific(tcache_key, tc);
+    memset(tc, 0, sizeof(*tc));
+    tc->generation = mm_generation;
+    tc->arena = &arenas[__atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED) % narenas];
+
+    pthread_mutex_lock(&tcache_lock);
+    tc->next = tcache_list;
+    tcache_list = tc;
+    pthread_mutex_unlock(&tcache_lock);
+  }
+
+  return tc;
+}
+
+
+/// @brief count @a n calls to malloc (@a isfree == 0) or free (@a isfree == 1) of blocks of
+///        @a size bytes in this thread's statistics
+/// @param isfree count frees (1) or mallocs (0)
+/// @param size block size in bytes
+/// @param n number of calls
+static void stat_count(int isfree, size_t size, unsigned long n)
+{
+  TCache *tc = tcache_get();
+  unsigned long *c = isfree ? tc->nfree : tc->nmalloc;
+  int cls = size_class(MAX(size, BS));
+
+  // single writer; readers in mm_getstats() only need to see whole values
+  __atomic_store_n(&c[cls], c[cls] + n, __ATOMIC_RELAXED);
+}
+
+
+/// @brief allocate a block of @a asize bytes from this thread's cache, refilling the bin from
+///        the home arena if it is empty.
+/// @param asize block size (including header & footer tags), in bytes
+/// @retval void* pointer to header of allocated block
+/// @retval NULL if the bin could not be refilled
+static void* tcache_malloc(size_t asize)
+{
+  TCache *tc = tcache_get();
+  int idx = asize/BS - 1;
+
+  if (tc->bin[idx] == NULL) {
+    Arena *a = tc->arena;
+    int n = MAX(tcache_count/2, 1);
+
+    LOCK(a);
+    while (n-- > 0) {
+      void *bp = heap_malloc(a, asize);
+      if (bp == NULL) break;
+      NEXT_LIST_GET(bp) = tc->bin[idx];
+      tc->bin[idx] = bp;
+      tc->count[idx]++;
+    }
+    UNLOCK(a);
+
+    if (tc->bin[idx] == NULL) return arena_malloc(a, asize);
+  }
+
+  void *bp = tc->bin[idx];
+  tc->bin[idx] = NEXT_LIST_GET(bp);
+  tc->count[idx]--;
+
+  return bp;
+}
+
+
+/// @brief put allocated block @a bp into this thread's cache, flushing half of the bin to the
+///        arenas if it is full.
+/// @param bp pointer to header of allocated block
+static void tcache_free(void *bp)
+{
+  TCache *tc = tcache_get();
+  int idx = SIZE(GET_SHARED(bp))/BS - 1;
+
+  if (tc->count[idx] >= tcache_count) tcache_flush(tc, idx, MAX(tcache_count/2, 1));
+
+  NEXT_LIST_GET(bp) = tc->bin[idx];
+  tc->bin[idx] = bp;
+  tc->count[idx]++;
+}
+
+
+/// @brief get the index of the SLAB_SIZE page containing @a p in the slab map of arena @a a
+/// @param a arena
+/// @param p address in the sub-segment of @a a
+/// @retval size_t page index
+static size_t slab_page(Arena *a, void *p)
+{
+  return WORD(p)/SLAB_SIZE - WORD(a->ds_heap_start)/SLAB_SIZE;
+}
+
+
+/// @brief get the slab containing @a ptr
+/// @param ptr pointer to memory
+/// @retval Slab* slab containing @a ptr
+/// @retval NULL if @a ptr does not point into a slab
+static Slab* slab_of(void *ptr)
+{
+  if (!mm_slab) return NULL;
+
+  Arena *a = arena_of(ptr);
+  uint64_t *map = __atomic_load_n(&a->slab_map, __ATOMIC_ACQUIRE);
+  if (map == NULL) return NULL;
+
+  size_t page = slab_page(a, ptr);
+  if (page >= a->slab_npages) return NULL;
+  if (!(__atomic_load_n(&map[page/64], __ATOMIC_RELAXED) & (1UL << (page%64)))) return NULL;
+
+  return PTR(WORD(ptr) & ~(TYPE)(SLAB_SIZE-1));
+}
+
+
+/// @brief carve a new slab for slot size class @a cls from arena @a a and put it at the head of
+///        the class' slab list. Must be called with the arena lock held.
+/// @param a arena
+/// @param cls slot size class
+/// @retval Slab* new slab
+/// @retval NULL if the heap could not be extended
+static Slab* slab_create(Arena *a, int cls)
+{
+  if (a->slab_map == NULL) {
+    void *end;
+    ds_heap_stat_seg(a->seg, NULL, NULL, &end);
+    size_t npages = slab_page(a, end) + 1;
+    size_t words = (npages + 63) / 64;
+
+    void *bp = heap_malloc(a, ROUND_BS(words*sizeof(uint64_t) + OVERHEAD));
+    if (bp == NULL) return NULL;
+    memset(NEXT_PTR(bp), 0, words*sizeof(uint64_t));
+    a->slab_npages = npages;
+    __atomic_store_n(&a->slab_map, (uint64_t*)NEXT_PTR(bp), __ATOMIC_RELEASE);
+  }
+
+  Slab *s = heap_malloc_aligned(a, SLAB_SIZE, SLAB_SIZE, 0);
+  if (s == NULL) return NULL;
+
+  LOG(2, "  slab_create(%lu): %p", slab_slotsize[cls], s);
+
+  s->cls = cls;
+  s->nslots = s->nfree = (SLAB_SIZE - SLAB_HDRSIZE - TYPE_SIZE) / slab_slotsize[cls];
+  memset(s->map, 0, sizeof(s->map));
+  for (int i=0; i<s->nslots; i++) s->map[i/64] |= 1UL << (i%64);
+
+  s->prev = NULL;
+  s->next = a->slab_list[cls];
+  if (s->next != NULL) s->next->prev = s;
+  a->slab_list[cls] = s;
+
+  size_t page = slab_page(a, s);
+  __atomic_fetch_or(&a->slab_map[page/64], 1UL << (page%64), __ATOMIC_RELAXED);
+
+  return s;
+}
+
+
+/// @brief unlink slab @a s from its class' slab list
+/// @param a arena owning @a s
+/// @param s slab
+static void slab_unlink(Arena *a, Slab *s)
+{
+  if (s->prev != NULL) s->prev->next = s->next;
+  else a->slab_list[s->cls] = s->next;
+  if (s->next != NULL) s->next->prev = s->prev;
+}
+
+
+/// @brief allocate a slot of size class @a cls from arena @a a. Must be called with the arena
+///        lock held.
+/// @param a arena
+/// @param cls slot size class
+/// @retval void* pointer to slot
+/// @retval NULL if no slab could be created
+static void* slab_malloc(Arena *a, int cls)
+{
+  Slab *s = a->slab_list[cls];
+  if (s == NULL) {
+    s = slab_create(a, cls);
+    if (s == NULL) return NULL;
+  }
+
+  int w = 0;
+  while (s->map[w] == 0) w++;
+  int i = w*64 + __builtin_ctzl(s->map[w]);
+  s->map[w] &= ~(1UL << (i%64));
+
+  // full slabs leave the list; they are re-linked when a slot is freed
+  if (--s->nfree == 0) slab_unlink(a, s);
+
+  return (void*)s + SLAB_HDRSIZE + i*slab_slotsize[cls];
+}
+
+
+/// @brief return slot @a ptr to slab @a s. The slab is returned to the heap if it becomes empty
+///        and is not the only slab of its class with free slots. Must be called with the arena
+///        lock held.
+/// @param a arena owning @a s
+/// @param s slab containing @a ptr
+/// @param ptr pointer to slot
+static void slab_free(Arena *a, Slab *s, void *ptr)
+{
+  size_t ofs = ptr - (void*)s - SLAB_HDRSIZE;
+  size_t i = ofs / slab_slotsize[s->cls];
+
+  if ((ptr < (void*)s + SLAB_HDRSIZE) || (ofs % slab_slotsize[s->cls] != 0) ||
+      (i >= s->nslots) || (s->map[i/64] & (1UL << (i%64)))) {
+    PANIC("Invalid pointer or double free: %p.", ptr);
+  }
+
+  s->map[i/64] |= 1UL << (i%64);
+
+  if (++s->nfree == 1) {
+    s->prev = NULL;
+    s->next = a->slab_list[s->cls];
+    if (s->next != NULL) s->next->prev = s;
+    a->slab_list[s->cls] = s;
+  } else if ((s->nfree == s->nslots) && ((s->prev != NULL) || (s->next != NULL))) {
+    LOG(2, "  slab_release(%lu): %p", slab_slotsize[s->cls], s);
+
+    slab_unlink(a, s);
+    size_t page = slab_page(a, s);
+    __atomic_fetch_and(&a->slab_map[page/64], ~(1UL << (page%64)), __ATOMIC_RELAXED);
+    heap_free(a, s);
+  }
+}
+
+
+/// @brief allocate a direct mapping for a request of @a size bytes. The payload starts @a ofs
+///        bytes into the page-aligned mapping.
+/// @param size requested size in bytes
+/// @param ofs offset of payload in mapping (multiple of BS, at most the page size)
+/// @retval void* pointer to payload
+/// @retval NULL if the mapping could not be created
+static void* mmap_malloc(size_t size, size_t ofs)
+{
+  size_t pgsize = getpagesize();
+  if (size > SIZE_MAX - ofs - pgsize) return NULL;
+
+  size_t msize = (size + ofs + pgsize-1) & ~(pgsize-1);
+  void *mp;
+  TIMED(MM_LAT_MMAP, mp = mmap(NULL, msize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0));
+  if (mp == MAP_FAILED) return NULL;
+
+  LOG(2, "  mmap_malloc(0x%lx (%lu)): %p", msize, msize, mp);
+
+  void *ptr = mp + ofs;
+  PUT(PREV_PTR(ptr), PACK(msize, MMAPPED | ALLOC));
+  PUT(PREV_PTR(PREV_PTR(ptr)), ofs);
+
+  __atomic_add_fetch(&mmap_count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&mmap_bytes, msize, __ATOMIC_RELAXED);
+
+  return ptr;
+}
+
+
+/// @brief release the direct mapping of @a ptr
+/// @param ptr pointer to payload of direct mapping
+static void mmap_free(void *ptr)
+{
+  size_t msize = GET_SIZE(PREV_PTR(ptr));
+  void *mp = ptr - GET(PREV_PTR(PREV_PTR(ptr)));
+
+  LOG(2, "  mmap_free(0x%lx (%lu)): %p", msize, msize, mp);
+
+  int res;
+  TIMED(MM_LAT_MMAP, res = munmap(mp, msize));
+  if (res != 0) PANIC("Invalid pointer: %p.", ptr);
+
+  __atomic_sub_fetch(&mmap_count, 1, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&mmap_bytes, msize, __ATOMIC_RELAXED);
+}
+
+
+/// @brief resize the direct mapping of @a ptr to hold @a size bytes. The mapping may move; its
+///        pages are remapped, not copied.
+/// @param ptr pointer to payload of direct mapping
+/// @param size requested new size in bytes
+/// @retval void* pointer to payload of resized mapping
+/// @retval NULL if the mapping could not be resized (@a ptr remains valid)
+static void* mmap_realloc(void *ptr, size_t size)
+{
+  size_t pgsize = getpagesize();
+  size_t ofs = GET(PREV_PTR(PREV_PTR(ptr)));
+  if (size > SIZE_MAX - ofs - pgsize) return NULL;
+
+  size_t msize = GET_SIZE(PREV_PTR(ptr));
+  size_t nsize = (size + ofs + pgsize-1) & ~(pgsize-1);
+  if (nsize == msize) return ptr;
+
+  // mappings stay page-aligned, so the payload keeps its alignment
+  void *mp;
+  TIMED(MM_LAT_MMAP, mp = mremap(ptr - ofs, msize, nsize, MREMAP_MAYMOVE));
+  if (mp == MAP_FAILED) return NULL;
+
+  LOG(2, "  mmap_realloc(0x%lx (%lu)): %p", nsize, nsize, mp);
+
+  ptr = mp + ofs;
+  PUT(PREV_PTR(ptr), PACK(nsize, MMAPPED | ALLOC));
+
+  __atomic_add_fetch(&mmap_bytes, nsize - msize, __ATOMIC_RELAXED);
+
+  return ptr;
+}
+
+
+/// @brief record an allocation call if tracing is on
+#define TRACE(op, ptr, old, size) \
+  do { if (__builtin_expect(TRACING, 0)) trace_event(op, ptr, old, size); } while (0)
+
+/// @brief attach this thread to the current trace session. Allocates its buffer on first use.
+/// @retval TraceBuf* this thread's buffer
+/// @retval NULL if tracing is off or no buffer could be allocated
+static TraceBuf* trace_attach(void)
+{
+  TraceBuf *tb = trace_buf;
+
+  if (tb == NULL) {
+    tb = mmap(NULL, sizeof(TraceBuf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (tb == MAP_FAILED) return NULL;
+  }
+
+  pthread_mutex_lock(&trace_lock);
+  if (trace_buf == NULL) {
+    tb->next = trace_list;
+    trace_list = tb;
+    trace_buf = tb;
+  }
+  if (mm_tracing) {
+    tb->head = tb->tail = tb->dropped = 0;
+    tb->session = trace_session;
+    tb->thread = trace_nthreads++;
+  }
+  pthread_mutex_unlock(&trace_lock);
+
+  return tb->session == trace_session ? tb : NULL;
+}
+
+
+/// @brief append a record to this thread's trace buffer
+/// @param op operation (MM_TRACE_xxx)
+/// @param ptr returned or freed pointer
+/// @param old original pointer (realloc) or alignment (memalign)
+/// @param size requested size in bytes
+static void trace_event(int op, void *ptr, void *old, size_t size)
+{
+  TraceBuf *tb = trace_buf;
+
+  if ((tb == NULL) || (tb->session != __atomic_load_n(&trace_session, __ATOMIC_RELAXED))) {
+    tb = trace_attach();
+    if (tb == NULL) return;
+  }
+
+  unsigned long head = tb->head;
+  if (head - __atomic_load_n(&tb->tail, __ATOMIC_ACQUIRE) >= TRACE_NRECS) {
+    tb->dropped++;
+    return;
+  }
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  struct mm_trace_rec *r = &tb->rec[head % TRACE_NRECS];
+  r->time   = (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+  r->ptr    = WORD(ptr);
+  r->old    = WORD(old);
+  r->size   = size;
+  r->thread = tb->thread;
+  r->op     = op;
+
+  __atomic_store_n(&tb->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+/// @brief write all new records of the current session to the trace file
+/// @retval size_t number of records written
+static size_t trace_flush(void)
+{
+  size_t total = 0;
+
+  pthread_mutex_lock(&trace_lock);
+  for (TraceBuf *tb = trace_list; tb != NULL; tb = tb->next) {
+    if (tb->session != trace_session) continue;
+
+    unsigned long head = __atomic_load_n(&tb->head, __ATOMIC_ACQUIRE);
+    unsigned long tail = tb->tail;
+
+    while (tail != head) {
+      size_t idx = tail % TRACE_NRECS;
+      size_t n = MIN(head - tail, TRACE_NRECS - idx);
+      fwrite(&tb->rec[idx], sizeof(struct mm_trace_rec), n, trace_file);
+      tail += n;
+      total += n;
+    }
+
+    __atomic_store_n(&tb->tail, tail, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&trace_lock);
+
+  return total;
+}
+
+
+/// @brief flusher thread
+/// @param arg unused
+static void* trace_flusher(void *arg)
+{
+  struct timespec interval = { 0, TRACE_INTERVAL };
+
+  (void)arg;
+  while (!__atomic_load_n(&trace_stop, __ATOMIC_ACQUIRE)) {
+    if (trace_flush() == 0) nanosleep(&interval, NULL);
+  }
+  trace_flush();
+
+  return NULL;
+}
+
+
+/// @brief mm_malloc() without tracing
+static void* malloc_impl(size_t size)
+{
+  LOG(1, "mm_malloc(0x%lx (%lu))", size, size);
+
+  assert(mm_initialized);
+
+  if ((size == 0) || (size > SIZE_MAX - 2*BS)) return NULL;
+
+  stat_count(0, ROUND_BS(size + OVERHEAD), 1);
+
+  //
+  // large requests get a mapping of their own
+  //
+  if (MMAP_SIZE(size)) return mmap_malloc(size, MMAP_HDRSIZE);
+
+  //
+  // tiny requests are served from slabs
+  //
+  if (mm_slab && (size <= SLAB_MAXSIZE)) {
+    Arena *a = tcache_get()->arena;
+    LOCK(a);
+    void *ptr = slab_malloc(a, slab_class[(size+7)/8]);
+    UNLOCK(a);
+    if (ptr != NULL) return ptr;
+  }
+
+  //
+  // block size: payload + header (+ footer), rounded up to BS
+  //
+  size_t asize = ROUND_BS(size + OVERHEAD);
+  void *bp;
+
+  if ((asize <= TCACHE_MAXSIZE) && (tcache_count > 0)) bp = tcache_malloc(asize);
+  else bp = arena_malloc(tcache_get()->arena, asize);
+
+  return bp != NULL ? NEXT_PTR(bp) : NULL;
+}
+
+
+/// @brief extend the heap by at least @a words words. The new area replaces the end sentinel,
+///        is coalesced with a free block preceeding it and inserted into the free list.
+/// @param a arena
+/// @param words number of words to extend the heap by
+/// @retval void* pointer to header of the (coalesced) new free block
+/// @retval NULL if the data segment could not be extended
+static void* extend_heap(Arena *a, size_t words)
+{
+  size_t size = ROUND_BS(words * TYPE_SIZE);
+
+  LOG(2, "  extend_heap(0x%lx (%lu))", size, size);
+
+  TIMER_START(t);
+  void *brk;
+  TIMED(MM_LAT_SBRK, brk = ds_sbrk_seg(a->seg, size));
+  if (brk == (void*)-1) return NULL;
+  ds_heap_stat_seg(a->seg, NULL, &a->ds_heap_brk, NULL);
+  a->nsbrk_grow++;
+  a->sbrk_grow_bytes += size;
+
+  // the old end sentinel becomes the header of the new free block
+  void *bp = a->heap_end;
+
+  a->heap_end = a->heap_end + size;
+  __atomic_add_fetch(&heap_bytes, size, __ATOMIC_RELAXED);
+  PUT(a->heap_end, PACK(0, ALLOC));
+  set_free(bp, size);
+
+  bp = coalesce(a, bp);
+  TIMER_STOP(MM_LAT_EXTEND, t);
+
+  return bp;
+}
+
+
+/// @brief shrink the heap of arena @a a such that at most @a pad bytes remain in the free block
+///        in front of the end sentinel. The released memory is returned to the data segment.
+/// @param a arena
+/// @param pad number of bytes to keep in the top free block
+/// @retval 1 if memory was released
+/// @retval 0 otherwise
+static int shrink_heap(Arena *a, size_t pad)
+{
+  if (GET_PREV_ALLOC(a->heap_end)) return 0;
+
+  void *bp = PREV_BLK(a->heap_end);
+  size_t size = GET_SIZE(bp);
+  size_t keep = pad < size ? ROUND_BS(pad) : size;
+  if (keep >= size) return 0;
+
+  LOG(2, "  shrink_heap(0x%lx (%lu))", size-keep, size-keep);
+
+  a->zero_start = MAX(a->zero_start, a->ds_heap_brk);
+
+  TIMER_START(t);
+  void *brk;
+  TIMED(MM_LAT_SBRK, brk = ds_sbrk_seg(a->seg, -(intptr_t)(size-keep)));
+  if (brk == (void*)-1) return 0;
+  ds_heap_stat_seg(a->seg, NULL, &a->ds_heap_brk, NULL);
+  a->nsbrk_shrink++;
+  a->sbrk_shrink_bytes += size-keep;
+
+  list_remove(a, bp);
+  TYPE prev_alloc = GET_PREV_ALLOC(bp);
+
+  a->heap_end = bp + keep;
+  __atomic_sub_fetch(&heap_bytes, size-keep, __ATOMIC_RELAXED);
+  PUT_SHARED(a->heap_end, PACK(0, ALLOC | prev_alloc)); // may follow an allocated block
+  if (keep > 0) {
+    set_free(bp, keep);
+    list_insert(a, bp);
+  }
+
+  a->chunksize = MAX(a->chunksize/2, CHUNKSIZE);
+  TIMER_STOP(MM_LAT_TRIM, t);
+
+  return 1;
+}
+
+
+/// @brief grow the heap of arena @a a by at least @a size bytes according to the growth policy.
+///        Doubles the arena's chunk size on success.
+/// @param a arena
+/// @param size minimal number of bytes to extend the heap by
+/// @retval void* pointer to header of the (coalesced) new free block
+/// @retval NULL if the data segment could not be extended
+static void* grow_heap(Arena *a, size_t size)
+{
+  void *bp = NULL;
+
+  if (size < a->chunksize) bp = extend_heap(a, a->chunksize / TYPE_SIZE);
+  if (bp == NULL) bp = extend_heap(a, MAX(size, CHUNKSIZE) / TYPE_SIZE);
+  if ((bp == NULL) && (size < CHUNKSIZE)) bp = extend_heap(a, size / TYPE_SIZE);
+
+  if (bp != NULL) a->chunksize = MAX(CHUNKSIZE, MIN(2*a->chunksize, MAXCHUNKSIZE));
+
+  return bp;
+}
+
+
+/// @brief merge free block @a bp with its free neighbours and insert the result into the free
+///        list. @a bp must not be on a free list yet.
+/// @param a arena
+/// @param bp pointer to header of free block
+/// @retval void* pointer to header of the merged free block
+static void* coalesce(Arena *a, void *bp)
+{
+  TIMER_START(t);
+  size_t size = GET_SIZE(bp);
+  void *next = NEXT_BLK(bp);
+
+  if (GET_STATUS(next) == FREE) {
+    list_remove(a, next);
+    size += GET_SIZE(next);
+    a->zero_start = MAX(a->zero_start, next + FREE_TAGS);
+  }
+
+  if (!GET_PREV_ALLOC(bp)) {
+    void *prev = PREV_BLK(bp);
+    list_remove(a, prev);
+    size += GET_SIZE(prev);
+    if (PREV_PTR(bp) >= a->zero_start) {
+      PUT(PREV_PTR(bp), 0);
+      PUT(bp, 0);
+    }
+    bp = prev;
+  }
+
+  set_free(bp, size);
+  list_insert(a, bp);
+
+  validate_op(a, bp);
+  TIMER_STOP(MM_LAT_COALESCE, t);
+
+  return bp;
+}
+
+
+/// @brief clear @a n bytes at @a p. Large areas are cleared with non-temporal stores that do not
+///        displace the contents of the caches.
+/// @param p start address
+/// @param n number of bytes
+static void mm_zero(void *p, size_t n)
+{
+#ifdef __SSE2__
+  if (n >= NTZERO_THLD) {
+    char *c = p, *end = c + n;
+    char *a = PTR((WORD(c) + 15) & ~(TYPE)15);
+    __m128i z = _mm_setzero_si128();
+
+    memset(c, 0, a - c);
+    for (c = a; c + 64 <= end; c += 64) {
+      _mm_stream_si128((__m128i*)c, z);
+      _mm_stream_si128((__m128i*)(c+16), z);
+      _mm_stream_si128((__m128i*)(c+32), z);
+      _mm_stream_si128((__m128i*)(c+48), z);
+    }
+    _mm_sfence();
+    memset(c, 0, end - c);
+    return;
+  }
+#endif
+
+  memset(p, 0, n);
+}
+
+
+/// @brief mm_calloc() without tracing
+static void* calloc_impl(size_t nmemb, size_t size)
+{
+  LOG(1, "mm_calloc(0x%lx, 0x%lx (%lu))", nmemb, size, size);
+
+  assert(mm_initialized);
+
+  if ((size != 0) && (nmemb > SIZE_MAX / size)) return NULL;
+
+  size_t nbytes = nmemb * size;
+  if ((nbytes == 0) || (nbytes > SIZE_MAX - 2*BS)) return NULL;
+
+  //
+  // slots and cached blocks are small; malloc() followed by memset()
+  //
+  size_t asize = ROUND_BS(nbytes + OVERHEAD);
+  if (!MMAP_SIZE(nbytes) &&
+      ((mm_slab && (nbytes <= SLAB_MAXSIZE)) || ((asize <= TCACHE_MAXSIZE) && (tcache_count > 0)))) {
+    void *payload = malloc_impl(nbytes);
+    if (payload != NULL) memset(payload, 0, nbytes);
+    return payload;
+  }
+
+  stat_count(0, asize, 1);
+
+  //
+  // new mappings are zero
+  //
+  if (MMAP_SIZE(nbytes)) return mmap_malloc(nbytes, MMAP_HDRSIZE);
+
+  //
+  // blocks above the zero watermark only need their free tags cleared
+  //
+  Arena *a = tcache_get()->arena;
+  void *bp = NULL;
+  int clean = 0;
+
+  for (int i=0; (i<narenas) && (bp == NULL); i++) {
+    LOCK(a);
+    void *zero_start = a->zero_start;
+    bp = heap_malloc(a, asize);
+    clean = (bp != NULL) && (bp >= zero_start);
+    UNLOCK(a);
+
+    a = &arenas[(a - arenas + 1) % narenas];
+  }
+
+  if (bp == NULL) return NULL;
+
+  void *payload = NEXT_PTR(bp);
+  if (clean) {
+    memset(payload, 0, MIN(nbytes, FREE_TAGS - TYPE_SIZE));
+    if (!mm_footers) PUT(NEXT_BLK(bp) - TYPE_SIZE, 0);
+  } else {
+    mm_zero(payload, nbytes);
+  }
+
+  return payload;
+}
+
+
+/// @brief mm_memalign() without tracing
+static void* memalign_impl(size_t alignment, size_t size)
+{
+  LOG(1, "mm_memalign(0x%lx, 0x%lx (%lu))", alignment, size, size);
+
+  assert(mm_initialized);
+
+  if ((alignment == 0) || (alignment & (alignment-1))) return NULL;
+  if (alignment <= TYPE_SIZE) return malloc_impl(size);
+  if ((size == 0) || (size > SIZE_MAX - 2*BS - alignment)) return NULL;
+
+  stat_count(0, ROUND_BS(size + OVERHEAD), 1);
+
+  //
+  // large requests get a mapping of their own with the payload at the requested offset
+  //
+  if (MMAP_SIZE(size) && (alignment <= (size_t)getpagesize())) {
+    return mmap_malloc(size, MAX(alignment, MMAP_HDRSIZE));
+  }
+
+  //
+  // block size: payload + header (+ footer) + tag and padding in front of the payload
+  //
+  size_t asize = ROUND_BS(size + OVERHEAD + ALIGN_OFS - TYPE_SIZE);
+  size_t align = MAX(alignment, BS);
+  Arena *a = tcache_get()->arena;
+  void *bp = NULL;
+
+  for (int i=0; (i<narenas) && (bp == NULL); i++) {
+    LOCK(a);
+    bp = heap_malloc_aligned(a, asize, align, ALIGN_OFS);
+    UNLOCK(a);
+
+    a = &arenas[(a - arenas + 1) % narenas];
+  }
+
+  if (bp == NULL) return NULL;
+
+  void *ptr = bp + ALIGN_OFS;
+  PUT(PREV_PTR(ptr), PACK(ALIGN_OFS, MMAPPED));
+
+  return ptr;
+}
+
+
+void* mm_aligned_alloc(size_t alignment, size_t size)
+{
+  return mm_memalign(alignment, size);
+}
+
+
+/// @brief shrink allocated block @a bp to @a asize bytes. The tail is split off and returned to
+///        the free list if it is large enough to form a block of its own.
+/// @param a arena owning @a bp
+/// @param bp pointer to header of allocated block
+/// @param asize new block size (including header & footer tags), in bytes
+static void shrink_block(Arena *a, void *bp, size_t asize)
+{
+  size_t size = GET_SIZE(bp);
+
+  if (size - asize < BS) return;
+
+  set_alloc(bp, asize);
+
+  void *rp = NEXT_BLK(bp);
+  set_free(rp, size-asize);
+
+  rp = coalesce(a, rp);
+  if ((NEXT_BLK(rp) == a->heap_end) && (GET_SIZE(rp) > a->chunksize + SHRINKTHLD)) {
+    shrink_heap(a, a->chunksize);
+  }
+}
+
+
+/// @brief try to resize allocated block @a bp to @a asize bytes without moving it. Shrinking
+///        always succeeds. Growing absorbs a free block following @a bp; at the top of the heap,
+///        the heap is extended first.
+/// @param a arena owning @a bp
+/// @param bp pointer to header of allocated block
+/// @param asize new block size (including header & footer tags), in bytes
+/// @retval 1 if the block was resized in place
+/// @retval 0 otherwise
+static int resize_block(Arena *a, void *bp, size_t asize)
+{
+  size_t size = GET_SIZE(bp);
+
+  if (asize <= size) {
+    shrink_block(a, bp, asize);
+    return 1;
+  }
+
+  void *next = NEXT_BLK(bp);
+  size_t avail = size;
+  if (GET_STATUS(next) == FREE) avail += GET_SIZE(next);
+
+  if (avail < asize) {
+    // the next block (if free) is the last one: grow the heap behind it
+    void *last = GET_STATUS(next) == FREE ? NEXT_BLK(next) : next;
+    if (last != a->heap_end) return 0;
+
+    if (grow_heap(a, asize - avail) == NULL) return 0;
+
+    next = NEXT_BLK(bp);
+    avail = size + GET_SIZE(next);
+  }
+
+  // absorb the free block following bp
+  list_remove(a, next);
+  set_alloc(bp, avail);
+  a->zero_start = MAX(a->zero_start, NEXT_BLK(bp));
+
+  shrink_block(a, bp, asize);
+
+  return 1;
+}
+
+
+/// @brief mm_realloc() without tracing
+static void* realloc_impl(void *ptr, size_t size)
+{
+  LOG(1, "mm_realloc(%p, 0x%lx (%lu))", ptr, size, size);
+
+  assert(mm_initialized);
+
+  if (ptr == NULL) return malloc_impl(size);
+
+  if (size == 0) {
+    free_impl(ptr);
+    return NULL;
+  }
+
+  if (size > SIZE_MAX - 2*BS) return NULL;
+
+  //
+  // slots cannot be resized; keep the slot if the new size still fits
+  //
+  Slab *s = slab_of(ptr);
+  if (s != NULL) {
+    if ((size <= SLAB_MAXSIZE) && (slab_class[(size+7)/8] == s->cls)) return ptr;
+
+    void *newptr = malloc_impl(size);
+    if (newptr == NULL) return NULL;
+
+    memcpy(newptr, ptr, MIN(size, slab_slotsize[s->cls]));
+    free_impl(ptr);
+
+    return newptr;
+  }
+
+  //
+  // direct mappings are remapped
+  //
+  void *bp = PREV_PTR(ptr);
+  TYPE hdr = GET_SHARED(bp);
+  if (IS_MMAPPED(hdr)) return mmap_realloc(ptr, size);
+
+  //
+  // resize in place if possible. Blocks growing beyond MMAPTHLD move to a mapping instead.
+  // Aligned blocks are always moved to a regular block.
+  //
+  int aligned = IS_ALIGNTAG(hdr);
+  if (aligned) bp = ptr - SIZE(hdr);
+
+  size_t asize = ROUND_BS(size + OVERHEAD);
+  size_t oldsize = SIZE(GET_SHARED(bp));
+  Arena *a = arena_of(bp);
+
+  if (!aligned && (!MMAP_SIZE(size) || (asize <= oldsize))) {
+    LOCK(a);
+    int resized = resize_block(a, bp, asize);
+    UNLOCK(a);
+
+    if (resized) return ptr;
+  }
+
+  //
+  // last resort: move the payload to a new block
+  //
+  void *newptr = malloc_impl(size);
+  if (newptr == NULL) return NULL;
+
+  size_t payload = bp + oldsize - (mm_footers ? TYPE_SIZE : 0) - ptr;
+  memcpy(newptr, ptr, MIN(size, payload));
+  free_impl(ptr);
+
+  return newptr;
+}
+
+
+/// @brief terminate the process if @a bp is not the header of an allocated heap block
+/// @param bp pointer to header of block
+static void check_block(void *bp)
+{
+  TYPE hdr = GET_SHARED(bp);
+  size_t size = SIZE(hdr);
+
+  if ((STATUS(hdr) != ALLOC) || !(GET_SHARED(bp + size) & PREV_ALLOC) ||
+      (mm_footers && (GET(bp + size - TYPE_SIZE) != PACK(size, ALLOC)))) {
+    PANIC("Invalid pointer or double free: %p.", NEXT_PTR(bp));
+  }
+}
+
+
+/// @brief mm_free() without tracing
+static void free_impl(void *ptr)
+{
+  LOG(1, "mm_free(%p)", ptr);
+
+  assert(mm_initialized);
+
+  if (ptr == NULL) return;
+
+  Slab *s = slab_of(ptr);
+  if (s != NULL) {
+    stat_count(1, ROUND_BS(slab_slotsize[s->cls] + OVERHEAD), 1);
+
+    Arena *a = arena_of(s);
+    LOCK(a);
+    slab_free(a, s, ptr);
+    UNLOCK(a);
+    return;
+  }
+
+  void *bp = PREV_PTR(ptr);
+  TYPE hdr = GET_SHARED(bp);
+
+  if (IS_MMAPPED(hdr)) {
+    stat_count(1, SIZE(hdr), 1);
+    mmap_free(ptr);
+    return;
+  }
+
+  if (IS_ALIGNTAG(hdr)) {
+    bp = ptr - SIZE(hdr);
+    hdr = GET_SHARED(bp);
+  }
+  check_block(bp);
+  stat_count(1, SIZE(hdr), 1);
+
+  if ((SIZE(hdr) <= TCACHE_MAXSIZE) && (tcache_count > 0)) {
+    tcache_free(bp);
+  } else {
+    Arena *a = arena_of(bp);
+    LOCK(a);
+    heap_free(a, bp);
+    UNLOCK(a);
+  }
+}
+
+
+/// @brief mm_free_sized() without tracing
+static void free_sized_impl(void *ptr, size_t size)
+{
+  LOG(1, "mm_free_sized(%p, 0x%lx (%lu))", ptr, size, size);
+
+  assert(mm_initialized);
+
+  if (ptr == NULL) return;
+
+  //
+  // slots are at most SLAB_MAXSIZE bytes, so larger blocks need no slab lookup. Mappings and
+  // aligned blocks are rare; they take the regular path.
+  //
+  void *bp = PREV_PTR(ptr);
+  TYPE hdr = GET_SHARED(bp);
+
+  if ((mm_slab && (size <= SLAB_MAXSIZE)) || IS_MMAPPED(hdr) || IS_ALIGNTAG(hdr)) {
+    free_impl(ptr);
+    return;
+  }
+
+  //
+  // the block is checked like in mm_free(); in addition, the size must fit into the block
+  //
+  size_t bsize = SIZE(hdr);
+  check_block(bp);
+  if (bsize < ROUND_BS(size + OVERHEAD)) {
+    PANIC("Invalid size for pointer: %p, %lu.", ptr, size);
+  }
+  stat_count(1, bsize, 1);
+
+  if ((bsize <= TCACHE_MAXSIZE) && (tcache_count > 0)) {
+    tcache_free(bp);
+  } else {
+    Arena *a = arena_of(bp);
+    LOCK(a);
+    heap_free(a, bp);
+    UNLOCK(a);
+  }
+}
+
+
+size_t mm_usable_size(void *ptr)
+{
+  assert(mm_initialized);
+
+  if (ptr == NULL) return 0;
+
+  Slab *s = slab_of(ptr);
+  if (s != NULL) return slab_slotsize[s->cls];
+
+  void *bp = PREV_PTR(ptr);
+
+  TYPE hdr = GET_SHARED(bp);
+
+  // the mapping extends from ptr - ofs over msize bytes
+  if (IS_MMAPPED(hdr)) return SIZE(hdr) - GET(PREV_PTR(bp));
+
+  if (IS_ALIGNTAG(hdr)) {
+    bp = ptr - SIZE(hdr);
+    hdr = GET_SHARED(bp);
+  }
+
+  return bp + SIZE(hdr) - (mm_footers ? TYPE_SIZE : 0) - ptr;
+}
+
+
+size_t mm_malloc_batch(size_t size, size_t n, void *out[])
+{
+  LOG(1, "mm_malloc_batch(0x%lx (%lu), %lu)", size, size, n);
+
+  assert(mm_initialized);
+
+  if ((size == 0) || (size > SIZE_MAX - 2*BS)) return 0;
+
+  size_t i = 0;
+  Arena *a = tcache_get()->arena;
+
+  if (MMAP_SIZE(size)) {
+    while ((i < n) && ((out[i] = mmap_malloc(size, MMAP_HDRSIZE)) != NULL)) i++;
+    stat_count(0, ROUND_BS(size + OVERHEAD), i);
+    if (TRACING) {
+      for (size_t k=0; k<i; k++) trace_event(MM_TRACE_MALLOC, out[k], NULL, size);
+    }
+    return i;
+  }
+
+  if (mm_slab && (size <= SLAB_MAXSIZE)) {
+    int cls = slab_class[(size+7)/8];
+    LOCK(a);
+    while ((i < n) && ((out[i] = slab_malloc(a, cls)) != NULL)) i++;
+    UNLOCK(a);
+  }
+
+  //
+  // the remaining requests (all of them if they are not served from slabs) get heap blocks
+  //
+  if (i < n) {
+    size_t asize = ROUND_BS(size + OVERHEAD);
+    size_t left = n - i;
+
+    LOCK(a);
+
+    //
+    // carve all blocks from one free block if possible
+    //
+    if ((left > 1) && (left <= (SIZE_MAX - MAXCHUNKSIZE) / asize)) {
+      void *bp = heap_malloc(a, left*asize);
+      if (bp != NULL) {
+        a->inuse_blocks += left-1;
+        for (; i<n; i++) {
+          set_alloc(bp, asize);
+          out[i] = NEXT_PTR(bp);
+          bp = NEXT_BLK(bp);
+        }
+      }
+    }
+
+    for (; i<n; i++) {
+      void *bp = heap_malloc(a, asize);
+      if (bp == NULL) break;
+      out[i] = NEXT_PTR(bp);
+    }
+
+    UNLOCK(a);
+
+    // the home arena is exhausted: try the others
+    for (; i<n; i++) {
+      void *bp = arena_malloc(a, asize);
+      if (bp == NULL) break;
+      out[i] = NEXT_PTR(bp);
+    }
+  }
+
+  stat_count(0, ROUND_BS(size + OVERHEAD), i);
+
+  if (TRACING) {
+    for (size_t k=0; k<i; k++) trace_event(MM_TRACE_MALLOC, out[k], NULL, size);
+  }
+
+  return i;
+}
+
+
+/// @brief compare two pointers by address (qsort() callback)
+/// @param a pointer to first pointer
+/// @param b pointer to second pointer
+/// @retval int <0, 0, >0 if the first pointer is below, equal to, or above the second one
+static int ptr_cmp(const void *a, const void *b)
+{
+  uintptr_t pa = (uintptr_t)*(void * const *)a, pb = (uintptr_t)*(void * const *)b;
+  return (pa > pb) - (pa < pb);
+}
+
+
+void mm_free_batch(void *ptrs[], size_t n)
+{
+  LOG(1, "mm_free_batch(%p, %lu)", ptrs, n);
+
+  assert(mm_initialized);
+
+  if (TRACING) {
+    for (size_t i=0; i<n; i++) {
+      if (ptrs[i] != NULL) trace_event(MM_TRACE_FREE, ptrs[i], NULL, 0);
+    }
+  }
+
+  //
+  // in address order, runs of adjacent blocks are merged into one block before it is freed and
+  // coalesced, and the arena lock is taken once per arena
+  //
+  qsort(ptrs, n, sizeof(void*), ptr_cmp);
+
+  Arena *locked = NULL;
+  void *run = NULL;
+  size_t runsize = 0;
+
+  for (size_t i=0; i<n; i++) {
+    void *ptr = ptrs[i];
+    if (ptr == NULL) continue;
+
+    Slab *s = slab_of(ptr);
+    void *bp = PREV_PTR(ptr);
+
+    TYPE hdr = s == NULL ? GET_SHARED(bp) : 0;
+
+    if (IS_MMAPPED(hdr)) {
+      stat_count(1, SIZE(hdr), 1);
+      mmap_free(ptr);
+      continue;
+    }
+    if (IS_ALIGNTAG(hdr)) bp = ptr - SIZE(hdr);
+
+    if ((s == NULL) && (run != NULL) && (bp == run + runsize)) {
+      check_block(bp);
+      stat_count(1, GET_SIZE(bp), 1);
+      runsize += GET_SIZE(bp);
+      locked->inuse_blocks--;
+      continue;
+    }
+
+    // free the pending run
+    if (run != NULL) {
+      set_alloc(run, runsize);
+      heap_free(locked, run);
+      run = NULL;
+    }
+
+    Arena *a = arena_of(s != NULL ? (void*)s : bp);
+    if (a != locked) {
+      if (locked != NULL) UNLOCK(locked);
+      LOCK(a);
+      locked = a;
+    }
+
+    if (s != NULL) {
+      stat_count(1, ROUND_BS(slab_slotsize[s->cls] + OVERHEAD), 1);
+      slab_free(a, s, ptr);
+    } else {
+      check_block(bp);
+      stat_count(1, GET_SIZE(bp), 1);
+      run = bp;
+      runsize = GET_SIZE(bp);
+    }
+  }
+
+  if (run != NULL) {
+    set_alloc(run, runsize);
+    heap_free(locked, run);
+  }
+
+  if (locked != NULL) UNLOCK(locked);
+}
+
+
+void* mm_malloc(size_t size)
+{
+  void *ptr;
+  TIMED(MM_LAT_MALLOC, ptr = malloc_impl(size));
+  TRACE(MM_TRACE_MALLOC, ptr, NULL, size);
+  return ptr;
+}
+
+
+void* mm_calloc(size_t nmemb, size_t size)
+{
+  void *ptr;
+  TIMED(MM_LAT_CALLOC, ptr = calloc_impl(nmemb, size));
+  TRACE(MM_TRACE_CALLOC, ptr, NULL, nmemb * size);
+  return ptr;
+}
+
+
+void* mm_memalign(size_t alignment, size_t size)
+{
+  void *ptr;
+  TIMED(MM_LAT_MALLOC, ptr = memalign_impl(alignment, size));
+  TRACE(MM_TRACE_MEMALIGN, ptr, PTR(alignment), size);
+  return ptr;
+}
+
+
+void* mm_realloc(void *ptr, size_t size)
+{
+  void *newptr;
+  TIMED(MM_LAT_REALLOC, newptr = realloc_impl(ptr, size));
+  TRACE(MM_TRACE_REALLOC, newptr, ptr, size);
+  return newptr;
+}
+
+
+void mm_free(void *ptr)
+{
+  // recorded before the block can be reused by another thread
+  if (ptr != NULL) TRACE(MM_TRACE_FREE, ptr, NULL, 0);
+  TIMED(MM_LAT_FREE, free_impl(ptr));
+}
+
+
+void mm_free_sized(void *ptr, size_t size)
+{
+  if (ptr != NULL) TRACE(MM_TRACE_FREE, ptr, NULL, 0);
+  TIMED(MM_LAT_FREE, free_sized_impl(ptr, size));
+}
+
+
+int mm_trace_start(const char *filename)
+{
+#ifdef MM_NOINSTR
+  errno = ENOSYS;
+  return -1;
+#endif
+
+  if (mm_tracing) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  FILE *f = fopen(filename, "wb");
+  if (f == NULL) return -1;
+
+  if (fwrite(MM_TRACE_MAGIC, 8, 1, f) != 1) {
+    fclose(f);
+    return -1;
+  }
+
+  pthread_mutex_lock(&trace_lock);
+  trace_file = f;
+  trace_session++;
+  trace_nthreads = 0;
+  trace_stop = 0;
+  pthread_mutex_unlock(&trace_lock);
+
+  if (pthread_create(&trace_thread, NULL, trace_flusher, NULL) != 0) {
+    fclose(f);
+    trace_file = NULL;
+    return -1;
+  }
+
+  __atomic_store_n(&mm_tracing, 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+
+size_t mm_trace_stop(void)
+{
+  if (!mm_tracing) return 0;
+
+  __atomic_store_n(&mm_tracing, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&trace_stop, 1, __ATOMIC_RELEASE);
+  pthread_join(trace_thread, NULL);
+
+  size_t dropped = 0;
+
+  pthread_mutex_lock(&trace_lock);
+  fclose(trace_file);
+  trace_file = NULL;
+
+  TraceBuf **link = &trace_list;
+  while (*link != NULL) {
+    TraceBuf *tb = *link;
+    if (tb->session == trace_session) dropped += tb->dropped;
+
+    if (__atomic_load_n(&tb->orphaned, __ATOMIC_ACQUIRE)) {
+      *link = tb->next;
+      munmap(tb, sizeof(TraceBuf));
+    } else {
+      link = &tb->next;
+    }
+  }
+  pthread_mutex_unlock(&trace_lock);
+
+  return dropped;
+}
+
+
+void mm_setloglevel(int level)
+{
+  mm_loglevel = level;
+}
+
+
+void mm_settcache(int count)
+{
+  tcache_count = MAX(count, 0);
+}
+
+
+void mm_setgrowth(size_t min, size_t max)
+{
+  CHUNKSIZE    = MAX(ROUND_BS(min), 2*BS);
+  MAXCHUNKSIZE = MAX(ROUND_BS(max), CHUNKSIZE);
+}
+
+
+void mm_setshrinkthreshold(size_t threshold)
+{
+  SHRINKTHLD = threshold;
+}
+
+
+void mm_setmmapthreshold(size_t threshold)
+{
+  MMAPTHLD = threshold;
+}
+
+
+void mm_setvalidation(int local, unsigned long period)
+{
+#ifndef MM_NOINSTR
+  mm_validate = local != 0;
+  VALIDATEPERIOD = period;
+#else
+  (void)local;
+  (void)period;
+#endif
+}
+
+
+int mm_trim(size_t pad)
+{
+  LOG(1, "mm_trim(0x%lx (%lu))", pad, pad);
+
+  assert(mm_initialized);
+
+  // cached blocks are in use from the heap's point of view; return ours first
+  TCache *tc = tcache_get();
+  for (int idx=0; idx<TCACHE_NBINS; idx++) tcache_flush(tc, idx, tc->count[idx]);
+
+  int res = 0;
+  for (int i=0; i<narenas; i++) {
+    LOCK(&arenas[i]);
+    defer_consolidate(&arenas[i]);
+    res |= shrink_heap(&arenas[i], pad);
+    UNLOCK(&arenas[i]);
+  }
+
+  return res;
+}
+
+
+/// @brief allocator metadata stored with a data segment snapshot
+#define MM_SNAPMAGIC "MMSNAP01"                        ///< magic number of the metadata
+typedef struct {
+  char magic[8];                                       ///< MM_SNAPMAGIC
+  FreelistPolicy fp;                                   ///< free list policy
+  int  options;                                        ///< mm_init_ex() options
+  int  narenas;                                        ///< number of arenas
+  size_t arena_stride;                                 ///< distance between sub-segment starts
+  Arena arenas[MAX_ARENAS];                            ///< arenas (locks are reinitialized)
+} MMSnapshot;
+
+
+int mm_snapshot(void)
+{
+  LOG(1, "mm_snapshot()");
+
+  assert(mm_initialized);
+
+  if (__atomic_load_n(&mmap_count, __ATOMIC_RELAXED) > 0) {
+    LOG(1, "  %lu direct mappings are live", mmap_count);
+    errno = EBUSY;
+    return -1;
+  }
+
+  MMSnapshot *snap = calloc(1, sizeof(MMSnapshot));
+  if (snap == NULL) return -1;
+
+  // cached blocks of the caller are returned; the heap must not change while it is written
+  TCache *tc = tcache_get();
+  for (int idx=0; idx<TCACHE_NBINS; idx++) tcache_flush(tc, idx, tc->count[idx]);
+
+  for (int i=0; i<narenas; i++) LOCK(&arenas[i]);
+
+  memcpy(snap->magic, MM_SNAPMAGIC, sizeof(snap->magic));
+  snap->fp           = freelist_policy;
+  snap->options      = (mm_footers ? 0 : MM_NOFOOTER) | (mm_slab ? MM_SLAB : 0) |
+                       (mm_defer ? MM_DEFER : 0);
+  snap->narenas      = narenas;
+  snap->arena_stride = arena_stride;
+  memcpy(snap->arenas, arenas, narenas*sizeof(Arena));
+
+  int res = ds_snapshot(snap, sizeof(MMSnapshot));
+  int err = errno;
+
+  for (int i=narenas-1; i>=0; i--) UNLOCK(&arenas[i]);
+
+  free(snap);
+  errno = err;
+
+  return res;
+}
+
+
+int mm_restore(const char *path)
+{
+  LOG(1, "mm_restore(%s)", path);
+
+  MMSnapshot *snap = malloc(sizeof(MMSnapshot));
+  if (snap == NULL) return -1;
+
+  ssize_t size = ds_restore(path, snap, sizeof(MMSnapshot));
+  if (size < 0) {
+    free(snap);
+    return -1;
+  }
+  if ((size != sizeof(MMSnapshot)) ||
+      (memcmp(snap->magic, MM_SNAPMAGIC, sizeof(snap->magic)) != 0) ||
+      (snap->narenas != ds_getnseg()) || !MM_SUPPORTED(snap->fp, snap->options)) {
+    LOG(1, "  no valid allocator metadata in %s", path);
+    ds_release();
+    free(snap);
+    errno = EINVAL;
+    return -1;
+  }
+
+  mm_configure(snap->fp, snap->options);
+
+  PAGESIZE     = ds_getpagesize();
+  narenas      = snap->narenas;
+  arena_stride = snap->arena_stride;
+  memcpy(arenas, snap->arenas, narenas*sizeof(Arena));
+  heap_bytes = 0;
+  for (int i=0; i<narenas; i++) {
+    pthread_mutex_init(&arenas[i].lock, NULL);
+    heap_bytes += arenas[i].heap_end - arenas[i].heap_start;
+  }
+  next_arena = 0;
+  free(snap);
+
+  tcache_list = NULL;
+  memset(retired_nmalloc, 0, sizeof(retired_nmalloc));
+  memset(retired_nfree, 0, sizeof(retired_nfree));
+#ifdef MM_TIMING
+  memset(retired_lat, 0, sizeof(retired_lat));
+#endif
+
+  mm_generation++;
+  mm_initialized = 1;
+
+  return 0;
+}
+
+
+/// @brief get the size of the largest free block of arena @a a. Searches the free blocks only if
+///        the largest one has been removed since the last search. Must be called with the arena
+///        lock held.
+/// @param a arena
+/// @retval size_t size of largest free block in bytes (0 if there is none)
+static size_t largest_free(Arena *a)
+{
+  if (!a->largest_stale) return a->largest_free;
+
+  size_t max = 0;
+  void *bp;
+
+  switch (freelist_policy) {
+    case fp_Implicit:
+      for (bp = a->heap_start; bp < a->heap_end; bp = NEXT_BLK(bp)) {
+        if (GET_STATUS(bp) == FREE) max = MAX(max, GET_SIZE(bp));
+      }
+      break;
+
+    case fp_Explicit:
+    case fp_AddrOrdered:
+    case fp_NextFit:
+      for (bp = a->free_list; bp != NULL; bp = NEXT_LIST_GET(bp)) max = MAX(max, GET_SIZE(bp));
+      break;
+
+    case fp_Segregated:
+      // only the largest non-empty class needs to be searched
+      if (a->seg_bitmap != 0) {
+        bp = a->seg_list[63 - __builtin_clzl(a->seg_bitmap)];
+        for (; bp != NULL; bp = NEXT_LIST_GET(bp)) max = MAX(max, GET_SIZE(bp));
+      }
+      break;
+
+    case fp_Tree:
+      if (a->free_list != NULL) max = BS;
+      for (bp = a->tree_root; bp != NULL; bp = RIGHT_TREE_GET(bp)) max = GET_SIZE(bp);
+      break;
+  }
+
+  a->largest_free = max;
+  a->largest_stale = 0;
+
+  return max;
+}
+
+
+void mm_getstats(struct mm_stats *stats)
+{
+  assert(mm_initialized);
+
+  memset(stats, 0, sizeof(*stats));
+
+  //
+  // heap counters: lock all arenas (in order) for a consistent snapshot
+  //
+  for (int i=0; i<narenas; i++) LOCK(&arenas[i]);
+
+  for (int i=0; i<narenas; i++) {
+    Arena *a = &arenas[i];
+
+    stats->heap_bytes        += a->heap_end - a->heap_start;
+    stats->free_bytes        += a->free_bytes;
+    stats->free_blocks       += a->free_blocks;
+    stats->inuse_blocks      += a->inuse_blocks;
+    stats->largest_free      = MAX(stats->largest_free, largest_free(a));
+    stats->nsbrk_grow        += a->nsbrk_grow;
+    stats->nsbrk_shrink      += a->nsbrk_shrink;
+    stats->sbrk_grow_bytes   += a->sbrk_grow_bytes;
+    stats->sbrk_shrink_bytes += a->sbrk_shrink_bytes;
+    for (int b=0; b<MM_NSEARCH; b++) stats->search_hist[b] += a->search_hist[b];
+    for (int c=0; c<MM_NCLASSES; c++) stats->free_hist[c] += a->free_hist[c];
+  }
+  stats->inuse_bytes = stats->heap_bytes - stats->free_bytes;
+  if (stats->free_bytes > 0) {
+    stats->fragmentation = 1.0 - (double)stats->largest_free / stats->free_bytes;
+  }
+
+  for (int i=narenas-1; i>=0; i--) UNLOCK(&arenas[i]);
+
+  stats->mmap_blocks = __atomic_load_n(&mmap_count, __ATOMIC_RELAXED);
+  stats->mmap_bytes  = __atomic_load_n(&mmap_bytes, __ATOMIC_RELAXED);
+
+  //
+  // call counters of live and exited threads
+  //
+  pthread_mutex_lock(&tcache_lock);
+  for (int c=0; c<MM_NCLASSES; c++) {
+    stats->nmalloc[c] = retired_nmalloc[c];
+    stats->nfree[c] = retired_nfree[c];
+  }
+  for (TCache *tc = tcache_list; tc != NULL; tc = tc->next) {
+    for (int c=0; c<MM_NCLASSES; c++) {
+      stats->nmalloc[c] += __atomic_load_n(&tc->nmalloc[c], __ATOMIC_RELAXED);
+      stats->nfree[c] += __atomic_load_n(&tc->nfree[c], __ATOMIC_RELAXED);
+    }
+  }
+  pthread_mutex_unlock(&tcache_lock);
+}
+
+
+size_t mm_footprint(void)
+{
+  return __atomic_load_n(&heap_bytes, __ATOMIC_RELAXED) +
+         __atomic_load_n(&mmap_bytes, __ATOMIC_RELAXED);
+}
+
+
+int mm_getlatency(struct mm_latency *lat)
+{
+  memset(lat, 0, sizeof(*lat));
+
+#ifdef MM_TIMING
+  pthread_mutex_lock(&tcache_lock);
+  memcpy(lat->count, retired_lat, sizeof(retired_lat));
+  for (TCache *tc = tcache_list; tc != NULL; tc = tc->next) {
+    for (int ph=0; ph<MM_NPHASES; ph++) {
+      for (int b=0; b<MM_LAT_BUCKETS; b++) {
+        lat->count[ph][b] += __atomic_load_n(&tc->lat[ph][b], __ATOMIC_RELAXED);
+      }
+    }
+  }
+  pthread_mutex_unlock(&tcache_lock);
+
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+
+uint64_t mm_latency_value(int bucket)
+{
+  if (bucket < 16) return bucket;
+
+  int e = (bucket-16)/8 + 4;
+  return (uint64_t)(8 + (bucket-16)%8) << (e-3);
+}
+
+
+uint64_t mm_latency_percentile(const struct mm_latency *lat, int phase, double p)
+{
+  unsigned long total = 0;
+  for (int b=0; b<MM_LAT_BUCKETS; b++) total += lat->count[phase][b];
+  if (total == 0) return 0;
+
+  unsigned long rank = (unsigned long)(p * (total-1)), n = 0;
+  int b = 0;
+  while ((n += lat->count[phase][b]) <= rank) b++;
+
+  return mm_latency_value(b);
+}
+
+
+int mm_iterate(int (*callback)(const struct mm_block *, size_t, void *), void *ptr)
+{
+  assert(mm_initialized);
+  assert(callback != NULL);
+
+  int res = 0;
+  size_t idx = 0;
+
+  for (int i=0; (i<narenas) && (res == 0); i++) {
+    Arena *a = &arenas[i];
+
+    LOCK(a);
+    for (void *bp = a->heap_start; (bp < a->heap_end) && (res == 0); bp = NEXT_BLK(bp)) {
+      struct mm_block b = {
+        .addr  = bp,
+        .size  = GET_SIZE(bp),
+        .type  = GET_STATUS(bp) == FREE ? MM_BLK_FREE : slab_of(bp) == bp ? MM_BLK_SLAB : MM_BLK_ALLOC,
+        .arena = i,
+      };
+      res = callback(&b, idx++, ptr);
+    }
+    UNLOCK(a);
+  }
+
+  return res;
+}
+
+
+/// @brief mm_iterate() callback writing one CSV line per block
+static int export_csv(const struct mm_block *b, size_t idx, void *ptr)
+{
+  static const char *type[] = { "free", "allocated", "slab" };
+  FILE *f = ptr;
+
+  (void)idx;
+  fprintf(f, "%d,%lu,%zu,%s\n", b->arena, (unsigned long)(b->addr - arenas[0].heap_start),
+          b->size, type[b->type]);
+
+  return ferror(f);
+}
+
+
+/// @brief mm_iterate() callback writing one binary record per block
+static int export_binary(const struct mm_block *b, size_t idx, void *ptr)
+{
+  uint64_t rec[2] = { (uint64_t)(b->addr - arenas[0].heap_start), b->size | b->type };
+
+  (void)idx;
+  return fwrite(rec, sizeof(rec), 1, ptr) != 1;
+}
+
+
+int mm_export(FILE *f, int format)
+{
+  assert(mm_initialized);
+  assert(f != NULL);
+
+  if (format == MM_EXPORT_CSV) {
+    fprintf(f, "arena,offset,size,type\n");
+    if (mm_iterate(export_csv, f) != 0) return -1;
+  } else {
+    if (mm_iterate(export_binary, f) != 0) return -1;
   }
 
-  long errors = 0;
-  p = heap_start;
-  while (p < heap_end) {
-    char *ofs_str, *size_str;
+  return fflush(f) == 0 ? 0 : -1;
+}
+
 
-    TYPE hdr = GET(p);
-    TYPE size = SIZE(hdr);
-    TYPE status = STATUS(hdr);
+void mm_check(void)
+{
+  assert(mm_initialized);
+
+  void *p;
 
-    void *next = NEXT_LIST_GET(p);
-    void *prev = PREV_LIST_GET(p);
+  char *fpstr;
+  if (freelist_policy == fp_Implicit) fpstr = "Implicit";
+  else if (freelist_policy == fp_Explicit) fpstr = "Explicit";
+  else if (freelist_policy == fp_Segregated) fpstr = "Segregated";
+  else if (freelist_policy == fp_Tree) fpstr = "Tree";
+  else if (freelist_policy == fp_AddrOrdered) fpstr = "Address-ordered";
+  else if (freelist_policy == fp_NextFit) fpstr = "Next fit";
+  else fpstr = "invalid";
 
-    if (asprintf(&ofs_str, "0x%lx", p-heap_start) < 0) ofs_str = NULL;
-    if (asprintf(&size_str, "0x%lx", size) < 0) size_str = NULL;
+  for (int i=0; i<narenas; i++) {
+    Arena *a = &arenas[i];
+
+    LOCK(a);
+
+    printf("----------------------------------------- mm_check ----------------------------------------------\n");
+    printf("  arena:                  %d of %d\n", i, narenas);
+    printf("  ds_heap_start:          %p\n", a->ds_heap_start);
+    printf("  ds_heap_brk:            %p\n", a->ds_heap_brk);
+    printf("  heap_start:             %p\n", a->heap_start);
+    printf("  heap_end:               %p\n", a->heap_end);
+    printf("  chunk size:             0x%lx (%lu)\n", a->chunksize, a->chunksize);
+    printf("  free list policy:       %s\n", fpstr);
+    printf("  footers:                %s\n", mm_footers ? "all blocks" : "free blocks only");
+
+    printf("\n");
+    p = PREV_PTR(a->heap_start);
+    printf("  initial sentinel:       %p: size: %6lx (%7ld), status: %s\n",
+           p, GET_SIZE(p), GET_SIZE(p), GET_STATUS(p) == ALLOC ? "allocated" : "free");
+    p = a->heap_end;
+    printf("  end sentinel:           %p: size: %6lx (%7ld), status: %s\n",
+           p, GET_SIZE(p), GET_SIZE(p), GET_STATUS(p) == ALLOC ? "allocated" : "free");
+    printf("\n");
 
     if(freelist_policy == fp_Implicit){
-      printf("    %p  %8s  %10s  %10ld  %8ld  %s\n",
-                p, ofs_str, size_str, size, size-2*TYPE_SIZE, status == ALLOC ? "allocated" : "free");
+      printf("    %-14s  %8s  %10s  %10s  %8s  %s\n", "address", "offset", "size (hex)", "size (dec)", "payload", "status");
     }
-    else if(freelist_policy == fp_Explicit){
-      printf("    %p  %8s  %10s  %10ld  %8ld  %-14p  %-14p  %s\n",
-                p, ofs_str, size_str, size, size-2*TYPE_SIZE,
-                status == ALLOC ? NULL : next, status == ALLOC ? NULL : prev,
-                status == ALLOC ? "allocated" : "free");
+    else {
+      printf("    %-14s  %8s  %10s  %10s  %8s  %-14s  %-14s  %s\n", "address", "offset", "size (hex)", "size (dec)", "payload", "next", "prev", "status");
     }
+
+    long errors = 0;
+    p = a->heap_start;
+    while (p < a->heap_end) {
+      char *ofs_str, *size_str;
+
+      TYPE hdr = GET(p);
+      TYPE size = SIZE(hdr);
+      TYPE status = STATUS(hdr);
+
+      void *next = NEXT_LIST_GET(p);
+      void *prev = PREV_LIST_GET(p);
+
+      if (asprintf(&ofs_str, "0x%lx", p-a->heap_start) < 0) ofs_str = NULL;
+      if (asprintf(&size_str, "0x%lx", size) < 0) size_str = NULL;
+
+      if(freelist_policy == fp_Implicit){
+        printf("    %p  %8s  %10s  %10ld  %8ld  %s\n",
+                  p, ofs_str, size_str, size, size-OVERHEAD,
+                  status == FREE ? "free" : slab_of(p) == p ? "slab" : "allocated");
+      }
+      else {
+        printf("    %p  %8s  %10s  %10ld  %8ld  %-14p  %-14p  %s\n",
+                  p, ofs_str, size_str, size, size-OVERHEAD,
+                  status == ALLOC ? NULL : next, status == ALLOC ? NULL : prev,
+                  status == FREE ? "free" : slab_of(p) == p ? "slab" : "allocated");
+      }
     
-    free(ofs_str);
-    free(size_str);
-
-    void *fp = p + size - TYPE_SIZE;
-    TYPE ftr = GET(fp);
-    TYPE fsize = SIZE(ftr);
-    TYPE fstatus = STATUS(ftr);
-
-    if ((size != fsize) || (status != fstatus)) {
-      errors++;
-      printf("    --> ERROR: footer at %p with different properties: size: %lx, status: %lx\n", 
-             fp, fsize, fstatus);
-      mm_panic("mm_check");
-    }
+      free(ofs_str);
+      free(size_str);
+
+      void *fp = p + size - TYPE_SIZE;
+      TYPE ftr = GET(fp);
+      TYPE fsize = SIZE(ftr);
+      TYPE fstatus = STATUS(ftr);
+
+      if ((mm_footers || (status == FREE)) && ((size != fsize) || (status != fstatus))) {
+        errors++;
+        printf("    --> ERROR: footer at %p with different properties: size: %lx, status: %lx\n", 
+               fp, fsize, fstatus);
+        mm_panic("mm_check");
+      }
 
-    p = p + size;
-    if (size == 0) {
-      printf("    WARNING: size 0 detected, aborting traversal.\n");
-      break;
+      if ((size > 0) && ((GET_PREV_ALLOC(p + size) != 0) != (status == ALLOC))) {
+        errors++;
+        printf("    --> ERROR: previous block status of %p does not match: %s\n",
+               p + size, GET_PREV_ALLOC(p + size) ? "allocated" : "free");
+        mm_panic("mm_check");
+      }
+
+      p = p + size;
+      if (size == 0) {
+        printf("    WARNING: size 0 detected, aborting traversal.\n");
+        break;
+      }
     }
+
+    printf("\n");
+    if ((p == a->heap_end) && (errors == 0)) printf("  Block structure coherent.\n");
+    printf("-------------------------------------------------------------------------------------------------\n");
+
+    UNLOCK(a);
   }
 
-  printf("\n");
-  if ((p == heap_end) && (errors == 0)) printf("  Block structure coherent.\n");
+  printf("  direct mappings:        %lu, 0x%lx (%lu) bytes\n",
+         __atomic_load_n(&mmap_count, __ATOMIC_RELAXED), __atomic_load_n(&mmap_bytes, __ATOMIC_RELAXED),
+         __atomic_load_n(&mmap_bytes, __ATOMIC_RELAXED));
   printf("-------------------------------------------------------------------------------------------------\n");
 }
 
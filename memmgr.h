@@ -35,6 +35,8 @@
 #define __MEMMGR_H__
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 // !! Remove allocation policy !!
 
@@ -42,11 +44,114 @@
 typedef enum {
   fp_Implicit,                    ///< Implicit list management
   fp_Explicit,                    ///< Explicit list management
+  fp_Segregated,                  ///< Segregated (size-class) explicit lists management
+  fp_Tree,                        ///< Size-ordered free tree management (best fit)
+  fp_AddrOrdered,                 ///< Address-ordered explicit list management (first fit)
+  fp_NextFit,                     ///< Address-ordered explicit list management (next fit)
 } FreelistPolicy;
 
+/// @name mm_getstats() dimensions
+/// @{
+#define MM_NCLASSES 64            ///< number of size classes
+#define MM_NSEARCH  16            ///< number of search length histogram buckets
+/// @}
+
+/// @brief allocator statistics (see mm_getstats()). Sizes of heap blocks include boundary tags.
+///
+/// Size class i covers blocks of BS*(i+1) bytes for i < 8, where BS is the block size (MM_BS,
+/// 32 by default). Above 8*BS bytes, every power-of-two range is split into four classes; the last
+/// class holds all remaining sizes. Requests are classified by the size of the heap block they
+/// would occupy.
+struct mm_stats {
+  size_t heap_bytes;              ///< total size of all heaps
+  size_t inuse_bytes;             ///< bytes in allocated heap blocks (including slabs and blocks
+                                  ///< held in thread caches)
+  size_t free_bytes;              ///< bytes in free heap blocks
+  unsigned long inuse_blocks;     ///< number of allocated heap blocks
+  unsigned long free_blocks;      ///< number of free heap blocks
+  size_t largest_free;            ///< size of largest free heap block
+  double fragmentation;           ///< external fragmentation: 1 - largest_free / free_bytes
+                                  ///< (0: all free memory is in one block)
+  unsigned long free_hist[MM_NCLASSES]; ///< free heap blocks per size class
+  unsigned long mmap_blocks;      ///< number of direct mappings
+  size_t mmap_bytes;              ///< bytes in direct mappings
+  unsigned long nmalloc[MM_NCLASSES]; ///< allocation calls per size class
+  unsigned long nfree[MM_NCLASSES];   ///< free calls per size class
+  unsigned long search_hist[MM_NSEARCH]; ///< free block searches by number of blocks inspected:
+                                  ///< bucket 0: none, bucket i: 2^(i-1) to 2^i - 1,
+                                  ///< last bucket: all longer searches
+  unsigned long nsbrk_grow;       ///< number of heap extensions
+  unsigned long nsbrk_shrink;     ///< number of heap reductions
+  size_t sbrk_grow_bytes;         ///< total heap extension in bytes
+  size_t sbrk_shrink_bytes;       ///< total heap reduction in bytes
+};
+
+/// @name mm_getlatency() phases
+/// @{
+#define MM_LAT_MALLOC      0      ///< mm_malloc(), mm_memalign()
+#define MM_LAT_CALLOC      1      ///< mm_calloc()
+#define MM_LAT_REALLOC     2      ///< mm_realloc()
+#define MM_LAT_FREE        3      ///< mm_free()
+#define MM_LAT_LOCK        4      ///< acquiring an arena lock
+#define MM_LAT_SEARCH      5      ///< free block search
+#define MM_LAT_SPLIT       6      ///< allocating (and splitting) a free block
+#define MM_LAT_COALESCE    7      ///< coalescing a free block with its neighbours
+#define MM_LAT_EXTEND      8      ///< heap extension (including sbrk)
+#define MM_LAT_SBRK        9      ///< ds_sbrk() (including page protection updates)
+#define MM_LAT_TRIM        10     ///< heap trimming (including sbrk)
+#define MM_LAT_MMAP        11     ///< mmap(), mremap(), munmap() of direct mappings
+#define MM_NPHASES         12     ///< number of phases
+#define MM_LAT_BUCKETS     256    ///< histogram buckets per phase (see mm_latency_value())
+/// @}
+
+/// @brief latency histograms (see mm_getlatency()). count[ph][b] is the number of times phase
+///        ph took between mm_latency_value(b) and mm_latency_value(b+1) nanoseconds; the last
+///        bucket also counts all longer times.
+struct mm_latency {
+  unsigned long count[MM_NPHASES][MM_LAT_BUCKETS];
+};
+
 /// @brief initialize heap. Must be called before any of the other functions can be used.
+///        One arena is created per sub-segment of the data segment (see ds_partition()).
+///        All other functions are thread-safe; mm_init() itself is not.
 void mm_init(FreelistPolicy ap);
 
+/// @name mm_init_ex() options
+/// @{
+#define MM_NOFOOTER 0x1           ///< allocated blocks carry no footer (8 instead of 16 bytes overhead)
+#define MM_SLAB     0x2           ///< serve requests of up to 64 bytes from slabs of fixed-size slots
+#define MM_DEFER    0x4           ///< defer coalescing of blocks of up to 512 bytes, reuse them as-is
+/// @}
+
+/// @name compile-time specialization
+/// Compiling memmgr.c with MM_POLICY (a FreelistPolicy) and/or MM_OPTIONS (mm_init_ex() options)
+/// defined fixes the configuration, e.g., -DMM_POLICY=fp_Segregated -DMM_OPTIONS=MM_SLAB. The
+/// free block search is then called directly and configuration tests fold away. MM_BS sets the
+/// block size/alignment (a power of 2 >= 32, default 32); MM_NOINSTR compiles out tracing and
+/// validation. Clients compiled with the same definitions can test with MM_SUPPORTED() which
+/// configurations mm_init_ex() accepts.
+/// @{
+#ifdef MM_POLICY
+  #define MM_POLICY_OK(fp)        ((fp) == (MM_POLICY))
+#else
+  #define MM_POLICY_OK(fp)        1
+#endif
+#ifdef MM_OPTIONS
+  #define MM_OPTIONS_OK(options)  ((options) == (MM_OPTIONS))
+#else
+  #define MM_OPTIONS_OK(options)  1
+#endif
+/// @brief nonzero if this build supports free list policy @a fp with @a options
+#define MM_SUPPORTED(fp, options) (MM_POLICY_OK(fp) && MM_OPTIONS_OK(options))
+/// @}
+
+/// @brief initialize heap with a free list policy and layout options. mm_init(fp) is equivalent
+///        to mm_init_ex(fp, 0). Configurations a specialized build does not support (see
+///        MM_SUPPORTED()) terminate the process.
+/// @param fp free list policy
+/// @param options bitwise OR of MM_* options
+void mm_init_ex(FreelistPolicy fp, int options);
+
 /// @brief allocate a block of memory of @a size bytes
 /// @param size requested size in bytes
 /// @retval void* pointer to first byte of memory on success
@@ -60,6 +165,22 @@ void* mm_malloc(size_t size);
 /// @retval NULL if memory allocation failed
 void* mm_calloc(size_t nelem, size_t size);
 
+/// @brief allocate a block of memory of @a size bytes whose address is a multiple of
+///        @a alignment. The block is freed with mm_free(); mm_realloc() does not preserve the
+///        alignment.
+/// @param alignment alignment in bytes (power of 2)
+/// @param size requested size in bytes
+/// @retval void* pointer to first byte of aligned memory on success
+/// @retval NULL if memory allocation failed or @a alignment is not a power of 2
+void* mm_memalign(size_t alignment, size_t size);
+
+/// @brief C11-style alias of mm_memalign()
+/// @param alignment alignment in bytes (power of 2)
+/// @param size requested size in bytes
+/// @retval void* pointer to first byte of aligned memory on success
+/// @retval NULL if memory allocation failed or @a alignment is not a power of 2
+void* mm_aligned_alloc(size_t alignment, size_t size);
+
 /// @brief re-allocate a block of memory to change its size to @a size bytes.
 /// @param ptr previously allocated block or NULL
 /// @param size requested new size in bytes
@@ -71,10 +192,201 @@ void* mm_realloc(void *ptr, size_t size);
 /// @param ptr pointer to allocated memory obtained by calling mm_malloc, mm_calloc, or mm_realloc
 void mm_free(void *ptr);
 
+/// @brief free a previously allocated block of memory of known size. Faster than mm_free() for
+///        blocks of more than 64 bytes: the size stands in for the slab lookup. The block is
+///        checked like in mm_free(), and @a size must fit into it.
+/// @param ptr pointer to allocated memory obtained by calling mm_malloc, mm_calloc, or mm_realloc
+/// @param size size requested for @a ptr, or any size up to mm_usable_size(@a ptr)
+void mm_free_sized(void *ptr, size_t size);
+
+/// @brief get the number of bytes usable at @a ptr. The payload of a block may extend beyond the
+///        requested size; callers may use all of it without calling mm_realloc().
+/// @param ptr pointer to allocated memory or NULL
+/// @retval size_t number of usable bytes (0 for NULL)
+size_t mm_usable_size(void *ptr);
+
+/// @brief allocate @a n blocks of memory of @a size bytes each. The blocks are carved from a
+///        single free block if possible.
+/// @param size requested size of each block in bytes
+/// @param n number of blocks
+/// @param[out] out array receiving pointers to the first byte of each block
+/// @retval size_t number of blocks allocated (< @a n if memory allocation failed)
+size_t mm_malloc_batch(size_t size, size_t n, void *out[]);
+
+/// @brief free @a n previously allocated blocks of memory. The blocks are freed in address order
+///        so that adjacent blocks coalesce; @a ptrs is sorted in place. NULL entries are ignored.
+/// @param ptrs array of pointers to allocated memory
+/// @param n number of pointers in @a ptrs
+void mm_free_batch(void *ptrs[], size_t n);
+
 /// @brief set log level
 /// @brief level log level (0: no logging, 1: info; 2: verbose)
 void mm_setloglevel(int level);
 
+/// @brief set the capacity of the per-thread caches of small blocks. Takes effect for blocks
+///        freed or allocated after the call.
+/// @param count maximum number of cached blocks per size (0: thread caches off)
+void mm_settcache(int count);
+
+/// @brief set the heap growth policy. The heap is extended by at least @a min bytes at a time;
+///        the extension size doubles with every extension up to @a max bytes and is halved when
+///        the heap shrinks. Must be called before mm_init(). @a min == @a max selects a fixed
+///        extension size. The effect can be observed through ds_getnsbrk().
+/// @param min initial (and minimal) heap extension size in bytes
+/// @param max maximal heap extension size in bytes
+void mm_setgrowth(size_t min, size_t max);
+
+/// @brief set the heap shrink threshold. The heap is shrunk automatically whenever the free
+///        block at its end exceeds the minimal heap extension size by more than @a threshold
+///        bytes.
+/// @param threshold shrink threshold in bytes
+void mm_setshrinkthreshold(size_t threshold);
+
+/// @brief set the direct mapping threshold. Requests of at least @a threshold bytes are not
+///        served from the heap but get a private mapping that is released when the block is
+///        freed. Takes effect for blocks allocated after the call.
+/// @param threshold direct mapping threshold in bytes (0: direct mappings off)
+void mm_setmmapthreshold(size_t threshold);
+
+/// @brief configure heap validation. Local checks verify the boundary tags, neighbours, and free
+///        list links of every block produced by an allocation or a free. Sampling additionally
+///        verifies a region of randomly chosen blocks about once every @a period operations of an
+///        arena. The cost of both is independent of the heap size. Inconsistencies terminate
+///        the process. Has no effect in builds with MM_NOINSTR.
+/// @param local enable local checks (1) or not (0)
+/// @param period average number of operations per sampled region (0: sampling off)
+void mm_setvalidation(int local, unsigned long period);
+
+/// @brief release free memory at the end of the heap(s) back to the data segment. The calling
+///        thread's cache of small blocks is flushed first.
+/// @param pad number of free bytes to keep at the end of each heap
+/// @retval 1 if memory was released
+/// @retval 0 otherwise
+int mm_trim(size_t pad);
+
+/// @brief persist the heap on a file-backed data segment (see ds_allocate_file()). Writes the
+///        allocator metadata along with a snapshot of the data segment. The calling thread's
+///        cache is flushed first; blocks cached by other threads remain allocated. Direct
+///        mappings cannot be persisted (disable them with mm_setmmapthreshold(0)).
+/// @retval 0 on success
+/// @retval -1 on error. errno is set to EBUSY (direct mappings are live) or by ds_snapshot()
+int mm_snapshot(void);
+
+/// @brief restore a heap persisted with mm_snapshot() and initialize the memory manager with it.
+///        Replaces the current data segment and heap; replaces ds_allocate*() and mm_init*().
+///        The heap is mapped at its original address, so pointers stored in it remain valid.
+/// @param path file backing the persisted data segment
+/// @retval 0 on success
+/// @retval -1 on error. errno is set to EINVAL (no valid snapshot) or by ds_restore()
+int mm_restore(const char *path);
+
+/// @brief get a snapshot of the allocator statistics. All counters are maintained incrementally;
+///        the call does not walk the heap. The heap counters are consistent with each other;
+///        per-size-class call counts of other threads are read without synchronization.
+/// @param[out] stats statistics
+void mm_getstats(struct mm_stats *stats);
+
+/// @brief get the memory footprint: the total size of all heaps plus all direct mappings. Unlike
+///        mm_getstats(), the call takes no locks and is cheap enough to be sampled after every
+///        operation.
+/// @retval size_t footprint in bytes (heap_bytes + mmap_bytes of mm_getstats())
+size_t mm_footprint(void);
+
+/// @brief get the latency histograms of all threads. The memory manager records them only if it
+///        has been compiled with MM_TIMING defined; otherwise @a lat is cleared.
+/// @param[out] lat latency histograms
+/// @retval 0 on success
+/// @retval -1 if latency instrumentation is not compiled in
+int mm_getlatency(struct mm_latency *lat);
+
+/// @brief get the lower bound of histogram bucket @a bucket. Buckets 0-15 hold 0-15 ns; above,
+///        every power of two is split into 8 buckets.
+/// @param bucket bucket index (0..MM_LAT_BUCKETS-1)
+/// @retval uint64_t smallest latency in ns counted in @a bucket
+uint64_t mm_latency_value(int bucket);
+
+/// @brief get percentile @a p of phase @a phase from the histograms @a lat
+/// @param lat latency histograms
+/// @param phase phase (MM_LAT_xxx)
+/// @param p percentile (0.0 - 1.0)
+/// @retval uint64_t lower bound of the bucket containing the percentile, in ns (0 if no samples)
+uint64_t mm_latency_percentile(const struct mm_latency *lat, int phase, double p);
+
+/// @name block types reported by mm_iterate()
+/// @{
+#define MM_BLK_FREE        0      ///< free block
+#define MM_BLK_ALLOC       1      ///< allocated block (also cached and deferred blocks)
+#define MM_BLK_SLAB        2      ///< slab of small slots
+/// @}
+
+/// @brief heap block as reported by mm_iterate()
+struct mm_block {
+  void *addr;                     ///< address of the block (header)
+  size_t size;                    ///< block size including boundary tags
+  int type;                       ///< block type (MM_BLK_xxx)
+  int arena;                      ///< index of the arena the block belongs to
+};
+
+/// @brief iterate through all heap blocks in address order and call @a callback for each of them.
+///        Each arena is locked while it is walked; the callback must not call into the memory
+///        manager. Direct mappings are not reported (see mm_getstats()).
+/// @param callback callback function. Iteration continues as long as @a callback returns 0.
+///                 The callback receives a pointer to the block, the index of the block, and the
+///                 pointer @a ptr provided to mm_iterate().
+/// @param ptr pointer passed to callback
+/// @retval 0 if all blocks have been iterated
+/// @retval otherwise: return value of last callback
+int mm_iterate(int (*callback)(const struct mm_block *, size_t, void *), void *ptr);
+
+/// @name mm_export() formats
+/// @{
+#define MM_EXPORT_CSV      0      ///< one line "arena,offset,size,type" per block, with header line
+#define MM_EXPORT_BINARY   1      ///< two uint64_t per block: offset, size | type
+/// @}
+
+/// @brief write a map of the heap to @a f. Offsets are relative to the start of the first arena;
+///        sizes include boundary tags and are multiples of 32, so in binary records the block
+///        type occupies the low bits of the size.
+/// @param f output stream
+/// @param format MM_EXPORT_CSV or MM_EXPORT_BINARY
+/// @retval 0 on success
+/// @retval -1 on write error
+int mm_export(FILE *f, int format);
+
+/// @name allocation trace format (see mm_trace_start())
+/// @{
+#define MM_TRACE_MAGIC     "MMTRACE1" ///< first 8 bytes of a trace file
+#define MM_TRACE_MALLOC    1      ///< mm_malloc() (also for each block of mm_malloc_batch())
+#define MM_TRACE_CALLOC    2      ///< mm_calloc(); size is the total size
+#define MM_TRACE_REALLOC   3      ///< mm_realloc(); old is the original pointer
+#define MM_TRACE_FREE      4      ///< mm_free() (also for each block of mm_free_batch())
+#define MM_TRACE_MEMALIGN  5      ///< mm_memalign(); old is the alignment
+/// @}
+
+/// @brief allocation trace record
+struct mm_trace_rec {
+  uint64_t time;                  ///< timestamp in ns (CLOCK_MONOTONIC)
+  uint64_t ptr;                   ///< returned pointer (freed pointer for MM_TRACE_FREE)
+  uint64_t old;                   ///< see MM_TRACE_xxx
+  uint64_t size;                  ///< requested size in bytes
+  uint32_t thread;                ///< index of recording thread (in order of first record)
+  uint32_t op;                    ///< operation (MM_TRACE_xxx)
+};
+
+/// @brief start recording all allocation calls to the trace file @a filename. The file consists
+///        of MM_TRACE_MAGIC followed by struct mm_trace_rec records. Records are written by a
+///        background thread; they are ordered by time per thread, but not across threads.
+///        Threads record without locking into per-thread buffers; records that do not fit into a
+///        full buffer are dropped.
+/// @param filename name of trace file
+/// @retval 0 on success
+/// @retval -1 on error. errno is set (EBUSY: tracing already on, ENOSYS: built with MM_NOINSTR)
+int mm_trace_start(const char *filename);
+
+/// @brief stop recording and close the trace file. Calls in flight may not be recorded.
+/// @retval size_t number of records dropped because a buffer was full
+size_t mm_trace_stop(void);
+
 /// @brief dump heap and perform some sanity checks
 void mm_check(void);
 
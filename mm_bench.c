@@ -0,0 +1,735 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Spring 2024
+//
+/// @file
+/// @brief trace replay benchmark for the dynamic memory manager
+/// @section changelog Change Log
+/// 2026/10/14 created
+///
+/// @section license_section License
+/// Copyright (c) 2020-2023, Computer Systems and Platforms Laboratory, SNU
+/// All rights reserved.
+///
+/// Redistribution and use in source and binary forms, with or without modification, are permitted
+/// provided that the following conditions are met:
+///
+/// - Redistributions of source code must retain the above copyright notice, this list of condi-
+///   tions and the following disclaimer.
+/// - Redistributions in binary form must reproduce the above copyright notice, this list of condi-
+///   tions and the following disclaimer in the documentation and/or other materials provided with
+///   the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+/// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE IMPLIED WARRANTIES OF MERCHANTABILITY
+/// AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+/// CONTRIBUTORS BE LIABLE FOR ANY DIRECT,  INDIRECT, INCIDENTAL,  SPECIAL,  EXEMPLARY,  OR CONSE-
+/// QUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+/// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)   HOWEVER CAUSED AND ON ANY THEORY OF
+/// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+/// DAMAGE.
+//--------------------------------------------------------------------------------------------------
+
+// Trace replay benchmark
+// ======================
+// mm_bench replays allocation traces against the free list policies of the memory manager and
+// against the null driver (which measures the overhead of the benchmark loop itself) and reports
+// throughput, per-operation latency percentiles, and peak memory utilization.
+//
+// Trace format:
+// -------------
+// Text, one operation per line. Blocks are identified by a non-negative integer id:
+//
+//   a <id> <size>             malloc
+//   c <id> <nmemb> <size>     calloc
+//   r <id> <size>             realloc (of NULL if <id> is not allocated)
+//   f <id>                    free
+//
+// Empty lines, comments starting with '#', and lines starting with a digit (the header of the
+// CS:APP malloc lab trace files) are skipped.
+//
+// Binary traces recorded with mm_trace_start() are detected by their magic number. Records are
+// sorted by time and pointers are mapped to ids; each freed id is reused by the next allocation.
+// Calls of all threads are replayed by a single thread.
+//
+// Measurements:
+// -------------
+// - every operation is timed individually with clock_gettime(CLOCK_MONOTONIC). Throughput is
+//   derived from the sum of the operation latencies; timing, payload verification (-v), and
+//   footprint sampling are not included.
+// - utilization: peak requested payload bytes over peak footprint (heap size plus direct
+//   mappings as reported by mm_footprint()), sampled after every operation.
+// - each repetition (-r) starts with a fresh data segment and heap.
+// - with -l, the latency histograms of the memory manager's internal phases (mm_getlatency())
+//   are summed over all repetitions and printed below the result line. This requires a memory
+//   manager compiled with MM_TIMING; the phase timers are included in the operation latencies.
+//
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dataseg.h"
+#include "memmgr.h"
+#include "nulldriver.h"
+
+
+/// @name trace operations
+/// @{
+#define OP_MALLOC   'a'
+#define OP_CALLOC   'c'
+#define OP_REALLOC  'r'
+#define OP_FREE     'f'
+/// @}
+
+#define MAX_IDS     (1u << 24)    ///< maximal number of distinct block ids in a trace
+
+/// @brief trace operation
+typedef struct {
+  char op;                        ///< operation (OP_xxx)
+  unsigned int id;                ///< block id
+  size_t nmemb;                   ///< number of members (calloc only)
+  size_t size;                    ///< payload size (member size for calloc)
+} Op;
+
+/// @brief trace
+typedef struct {
+  const char *name;               ///< file name
+  Op *ops;                        ///< operations
+  size_t nops;                    ///< number of operations
+  unsigned int nids;              ///< number of block ids (largest id + 1)
+} Trace;
+
+/// @brief allocator under test
+typedef struct {
+  char key;                       ///< selection key (-d)
+  const char *name;               ///< name
+  int fp;                         ///< free list policy (-1: null driver)
+  void* (*malloc)(size_t);
+  void* (*calloc)(size_t, size_t);
+  void* (*realloc)(void*, size_t);
+  void  (*free)(void*);
+} Driver;
+
+/// @brief result of replaying a trace
+typedef struct {
+  uint64_t total_ns;              ///< sum of operation latencies
+  size_t peak_live;               ///< peak requested payload bytes
+  size_t peak_footprint;          ///< peak heap size plus direct mappings
+  ssize_t nsbrk;                  ///< number of sbrk calls
+} Result;
+
+static Driver drivers[] = {
+  { 'i', "implicit",   fp_Implicit,    mm_malloc,   mm_calloc,   mm_realloc,   mm_free   },
+  { 'e', "explicit",   fp_Explicit,    mm_malloc,   mm_calloc,   mm_realloc,   mm_free   },
+  { 's', "segregated", fp_Segregated,  mm_malloc,   mm_calloc,   mm_realloc,   mm_free   },
+  { 't', "tree",       fp_Tree,        mm_malloc,   mm_calloc,   mm_realloc,   mm_free   },
+  { 'a', "addrorder",  fp_AddrOrdered, mm_malloc,   mm_calloc,   mm_realloc,   mm_free   },
+  { 'f', "nextfit",    fp_NextFit,     mm_malloc,   mm_calloc,   mm_realloc,   mm_free   },
+  { 'n', "null",       -1,             null_malloc, null_calloc, null_realloc, null_free },
+};
+#define NUM_DRIVERS (sizeof(drivers) / sizeof(drivers[0]))
+
+/// @name options
+/// @{
+static size_t heap_size = 256UL << 20;    ///< data segment size
+#ifdef MM_OPTIONS
+static int mm_options = MM_OPTIONS;       ///< options passed to mm_init_ex() (fixed by the build)
+#else
+static int mm_options = 0;                ///< options passed to mm_init_ex()
+#endif
+static int repeat = 1;                    ///< number of repetitions per trace and driver
+static int verify = 0;                    ///< verify payloads (yes: 1, no: 0)
+static int phases = 0;                    ///< print phase latencies (yes: 1, no: 0)
+/// @}
+
+
+/// @brief check whether the memory manager supports driver @a d with the selected options
+///        (specialized builds, see MM_SUPPORTED())
+/// @param d driver
+/// @retval 1 if supported
+/// @retval 0 otherwise
+static int supported(const Driver *d)
+{
+  return (d->fp < 0) || MM_SUPPORTED(d->fp, mm_options);
+}
+
+static struct mm_latency phase_lat;       ///< phase latencies summed over all repetitions
+
+
+/// @brief get current time in nanoseconds
+static inline uint64_t now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+
+/// @brief append operation @a op to trace @a t
+/// @retval 0 on success
+/// @retval -1 if out of memory
+static int add_op(Trace *t, Op op)
+{
+  if ((t->nops & (t->nops - 1)) == 0) {
+    Op *ops = realloc(t->ops, (t->nops ? 2*t->nops : 1) * sizeof(Op));
+    if (ops == NULL) return -1;
+    t->ops = ops;
+  }
+
+  t->ops[t->nops++] = op;
+  if (op.id >= t->nids) t->nids = op.id + 1;
+
+  return 0;
+}
+
+
+/// @brief recorded trace event with its position in the trace file
+typedef struct {
+  struct mm_trace_rec rec;        ///< record
+  size_t pos;                     ///< index in file
+} Event;
+
+/// @brief qsort comparison function ordering events by time, then file position
+static int cmp_event(const void *a, const void *b)
+{
+  const Event *x = a, *y = b;
+
+  if (x->rec.time != y->rec.time) return x->rec.time < y->rec.time ? -1 : 1;
+  return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+/// @brief pointer to id map (open addressing, linear probing)
+typedef struct {
+  uint64_t *ptr;                  ///< pointers (0: empty slot)
+  unsigned int *id;               ///< ids
+  size_t mask;                    ///< number of slots - 1
+} IdMap;
+
+/// @brief home slot of pointer @a p
+static size_t map_hash(const IdMap *m, uint64_t p)
+{
+  return ((p >> 3) * 0x9e3779b97f4a7c15UL >> 20) & m->mask;
+}
+
+/// @brief find the slot of pointer @a p (or the empty slot to insert it at)
+static size_t map_find(const IdMap *m, uint64_t p)
+{
+  size_t i = map_hash(m, p);
+  while ((m->ptr[i] != 0) && (m->ptr[i] != p)) i = (i + 1) & m->mask;
+  return i;
+}
+
+/// @brief remove the entry in slot @a i, moving entries of the probe sequence back
+static void map_remove(IdMap *m, size_t i)
+{
+  m->ptr[i] = 0;
+
+  for (size_t j = (i + 1) & m->mask; m->ptr[j] != 0; j = (j + 1) & m->mask) {
+    size_t k = map_hash(m, m->ptr[j]);
+    // move the entry at j to i if its home slot k is not in (i, j]
+    if (((j > i) && ((k <= i) || (k > j))) || ((j < i) && (k <= i) && (k > j))) {
+      m->ptr[i] = m->ptr[j];
+      m->id[i] = m->id[j];
+      m->ptr[j] = 0;
+      i = j;
+    }
+  }
+}
+
+
+/// @brief convert the binary trace in @a f (positioned after the magic number) to trace @a t
+/// @retval 0 on success
+/// @retval -1 on error (an error message has been printed)
+static int load_binary(FILE *f, Trace *t)
+{
+  Event *ev = NULL;
+  size_t nev = 0, cap = 0;
+  struct mm_trace_rec rec;
+
+  while (fread(&rec, sizeof(rec), 1, f) == 1) {
+    if (nev == cap) {
+      cap = cap ? 2*cap : 4096;
+      Event *e = realloc(ev, cap * sizeof(Event));
+      if (e == NULL) {
+        free(ev);
+        fprintf(stderr, "%s: out of memory\n", t->name);
+        return -1;
+      }
+      ev = e;
+    }
+    ev[nev].rec = rec;
+    ev[nev].pos = nev;
+    nev++;
+  }
+  qsort(ev, nev, sizeof(Event), cmp_event);
+
+  IdMap m;
+  size_t slots = 1024;
+  while (slots < 2*nev) slots *= 2;
+  m.ptr = calloc(slots, sizeof(uint64_t));
+  m.id = malloc(slots * sizeof(unsigned int));
+  m.mask = slots - 1;
+
+  unsigned int *freeids = malloc((nev + 1) * sizeof(unsigned int));
+  size_t nfreeids = 0;
+  unsigned int next_id = 0;
+  int res = 0;
+
+  if ((m.ptr == NULL) || (m.id == NULL) || (freeids == NULL)) res = -1;
+
+  for (size_t i=0; (i<nev) && (res == 0); i++) {
+    const struct mm_trace_rec *r = &ev[i].rec;
+    Op op = { 0 };
+    unsigned int oldid = 0;
+    int hasold = 0;
+
+    // the original block of a realloc (or the block being freed)
+    uint64_t optr = r->op == MM_TRACE_REALLOC ? r->old : r->op == MM_TRACE_FREE ? r->ptr : 0;
+    if (optr != 0) {
+      size_t k = map_find(&m, optr);
+      if (m.ptr[k] != 0) {
+        oldid = m.id[k];
+        hasold = 1;
+        map_remove(&m, k);
+      }
+    }
+
+    if (r->op == MM_TRACE_FREE) {
+      if (!hasold) continue;
+      op = (Op){ .op = OP_FREE, .id = oldid };
+      freeids[nfreeids++] = oldid;
+    } else if (r->ptr == 0) {
+      // failed allocation, or realloc to size 0
+      if (!hasold) continue;
+      op = (Op){ .op = OP_FREE, .id = oldid };
+      freeids[nfreeids++] = oldid;
+    } else {
+      size_t k = map_find(&m, r->ptr);
+      if (m.ptr[k] != 0) {
+        // the free of this block was not recorded
+        res = add_op(t, (Op){ .op = OP_FREE, .id = m.id[k] });
+        freeids[nfreeids++] = m.id[k];
+        map_remove(&m, k);
+        k = map_find(&m, r->ptr);
+      }
+
+      unsigned int id = hasold ? oldid : nfreeids > 0 ? freeids[--nfreeids] : next_id++;
+      switch (r->op) {
+        case MM_TRACE_CALLOC:  op = (Op){ .op = OP_CALLOC, .id = id, .nmemb = 1, .size = r->size }; break;
+        case MM_TRACE_REALLOC: op = (Op){ .op = OP_REALLOC, .id = id, .size = r->size }; break;
+        default:               op = (Op){ .op = OP_MALLOC, .id = id, .size = r->size }; break;
+      }
+      m.ptr[k] = r->ptr;
+      m.id[k] = id;
+    }
+
+    if ((res == 0) && (op.id >= MAX_IDS)) {
+      fprintf(stderr, "%s: too many live blocks\n", t->name);
+      res = -2;
+    }
+    if (res == 0) res = add_op(t, op);
+  }
+
+  if (res == -1) fprintf(stderr, "%s: out of memory\n", t->name);
+
+  free(ev);
+  free(m.ptr);
+  free(m.id);
+  free(freeids);
+
+  return res < 0 ? -1 : 0;
+}
+
+
+/// @brief load trace from file @a fn
+/// @param fn file name
+/// @param[out] t trace
+/// @retval 0 on success
+/// @retval -1 on error (an error message has been printed)
+static int load_trace(const char *fn, Trace *t)
+{
+  FILE *f = fopen(fn, "r");
+  if (f == NULL) {
+    fprintf(stderr, "%s: %s\n", fn, strerror(errno));
+    return -1;
+  }
+
+  char *line = NULL;
+  size_t llen = 0, lineno = 0;
+  int res = 0;
+
+  memset(t, 0, sizeof(*t));
+  t->name = fn;
+
+  char magic[8];
+  if ((fread(magic, sizeof(magic), 1, f) == 1) && (memcmp(magic, MM_TRACE_MAGIC, 8) == 0)) {
+    res = load_binary(f, t);
+    fclose(f);
+    if (res != 0) free(t->ops);
+    return res;
+  }
+  rewind(f);
+
+  while (getline(&line, &llen, f) > 0) {
+    char *l = line;
+    lineno++;
+
+    while ((*l == ' ') || (*l == '\t')) l++;
+    if ((*l == '\0') || (*l == '\n') || (*l == '#') || ((*l >= '0') && (*l <= '9'))) continue;
+
+    Op op = { .op = *l };
+    int n;
+    switch (op.op) {
+      case OP_MALLOC:
+      case OP_REALLOC: n = sscanf(l+1, "%u %zu", &op.id, &op.size) - 2; break;
+      case OP_CALLOC:  n = sscanf(l+1, "%u %zu %zu", &op.id, &op.nmemb, &op.size) - 3; break;
+      case OP_FREE:    n = sscanf(l+1, "%u", &op.id) - 1; break;
+      default:         n = -1;
+    }
+    if ((n != 0) || (op.id >= MAX_IDS)) {
+      fprintf(stderr, "%s:%zu: invalid operation\n", fn, lineno);
+      res = -1;
+      break;
+    }
+
+    if (add_op(t, op) != 0) {
+      fprintf(stderr, "%s: out of memory\n", fn);
+      res = -1;
+      break;
+    }
+  }
+
+  free(line);
+  fclose(f);
+
+  if (res != 0) free(t->ops);
+
+  return res;
+}
+
+
+/// @brief fill payload @a p of @a size bytes with a pattern derived from @a id
+static void fill(void *p, size_t size, unsigned int id)
+{
+  memset(p, (id * 0x9d) & 0xff, size);
+}
+
+
+/// @brief check that the first @a size bytes of payload @a p contain the pattern of @a id
+static int check(const void *p, size_t size, unsigned int id)
+{
+  const unsigned char *c = p;
+  unsigned char v = (id * 0x9d) & 0xff;
+
+  for (size_t i=0; i<size; i++) {
+    if (c[i] != v) return 0;
+  }
+
+  return 1;
+}
+
+
+/// @brief replay trace @a t with driver @a d
+/// @param d driver
+/// @param t trace
+/// @param[out] lat latency of each operation in ns (@a t->nops entries)
+/// @param[out] r result
+/// @retval 0 on success
+/// @retval -1 on error (an error message has been printed)
+static int replay(const Driver *d, const Trace *t, uint32_t *lat, Result *r)
+{
+  void **ptr = calloc(t->nids, sizeof(void*));
+  size_t *size = calloc(t->nids, sizeof(size_t));
+  int mm = d->fp >= 0;
+  int res = 0;
+
+  if ((ptr == NULL) || (size == NULL)) {
+    fprintf(stderr, "out of memory\n");
+    free(ptr);
+    free(size);
+    return -1;
+  }
+
+  memset(r, 0, sizeof(*r));
+  if (mm) {
+    ds_allocate(heap_size);
+    mm_init_ex(d->fp, mm_options);
+  }
+
+  size_t live = 0;
+  for (size_t i=0; i<t->nops; i++) {
+    const Op *op = &t->ops[i];
+    unsigned int id = op->id;
+    size_t nsize = op->op == OP_CALLOC ? op->nmemb * op->size : op->size;
+    void *p = NULL;
+
+    if (verify && mm && (ptr[id] != NULL) && !check(ptr[id], size[id], id)) {
+      fprintf(stderr, "%s/%s: op %zu: payload of block %u corrupted\n", t->name, d->name, i, id);
+      res = -1;
+      break;
+    }
+
+    uint64_t start = now();
+    switch (op->op) {
+      case OP_MALLOC:  p = d->malloc(op->size); break;
+      case OP_CALLOC:  p = d->calloc(op->nmemb, op->size); break;
+      case OP_REALLOC: p = d->realloc(ptr[id], op->size); break;
+      case OP_FREE:    d->free(ptr[id]); break;
+    }
+    uint64_t elapsed = now() - start;
+
+    lat[i] = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+    r->total_ns += elapsed;
+
+    if (op->op == OP_FREE) {
+      live -= size[id];
+      ptr[id] = NULL;
+      size[id] = 0;
+    } else if ((p == NULL) && (nsize > 0)) {
+      fprintf(stderr, "%s/%s: op %zu: out of memory\n", t->name, d->name, i);
+      res = -1;
+      break;
+    } else {
+      if (verify && mm && (p != NULL)) {
+        if ((op->op == OP_CALLOC) && !check(p, nsize, 0)) {   // the pattern of id 0 is zero
+          fprintf(stderr, "%s/%s: op %zu: calloc'd block not zero\n", t->name, d->name, i);
+          res = -1;
+          break;
+        }
+        fill(p, nsize, id);
+      }
+      live = live - size[id] + nsize;
+      ptr[id] = p;
+      size[id] = nsize;
+    }
+
+    if (live > r->peak_live) r->peak_live = live;
+    if (mm && (mm_footprint() > r->peak_footprint)) r->peak_footprint = mm_footprint();
+  }
+
+  if (mm) {
+    for (unsigned int id=0; id<t->nids; id++) mm_free(ptr[id]);
+    r->nsbrk = ds_getnsbrk();
+    if (phases) {
+      struct mm_latency l;
+      mm_getlatency(&l);
+      for (int ph=0; ph<MM_NPHASES; ph++) {
+        for (int b=0; b<MM_LAT_BUCKETS; b++) phase_lat.count[ph][b] += l.count[ph][b];
+      }
+    }
+    ds_release();
+  } else {
+    r->nsbrk = -1;
+  }
+
+  free(ptr);
+  free(size);
+
+  return res;
+}
+
+
+/// @brief qsort comparison function for latencies
+static int cmp_lat(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+  return (x > y) - (x < y);
+}
+
+
+/// @brief print the phase latencies collected in phase_lat
+static void print_phases(void)
+{
+  static const char *name[MM_NPHASES] = {
+    "malloc", "calloc", "realloc", "free", "lock", "search",
+    "split", "coalesce", "extend", "sbrk", "trim", "mmap"
+  };
+
+  for (int ph=0; ph<MM_NPHASES; ph++) {
+    unsigned long n = 0;
+    for (int b=0; b<MM_LAT_BUCKETS; b++) n += phase_lat.count[ph][b];
+    if (n == 0) continue;
+
+    printf("  %-18s %-10s %9lu %8s %7lu %7lu %7lu %7lu\n", name[ph], "", n, "",
+           mm_latency_percentile(&phase_lat, ph, 0.5),
+           mm_latency_percentile(&phase_lat, ph, 0.9),
+           mm_latency_percentile(&phase_lat, ph, 0.99),
+           mm_latency_percentile(&phase_lat, ph, 0.999));
+  }
+}
+
+
+/// @brief run trace @a t against driver @a d and print result line
+static void run(const Driver *d, const Trace *t)
+{
+  size_t n = t->nops * repeat;
+  uint32_t *lat = malloc((n > 0 ? n : 1) * sizeof(uint32_t));
+  Result total = { 0 };
+
+  memset(&phase_lat, 0, sizeof(phase_lat));
+
+  if (lat == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return;
+  }
+
+  for (int i=0; i<repeat; i++) {
+    Result r;
+    if (replay(d, t, &lat[i * t->nops], &r) != 0) {
+      free(lat);
+      return;
+    }
+    total.total_ns += r.total_ns;
+    if (r.peak_live > total.peak_live) total.peak_live = r.peak_live;
+    if (r.peak_footprint > total.peak_footprint) total.peak_footprint = r.peak_footprint;
+    total.nsbrk = r.nsbrk;
+  }
+
+  qsort(lat, n, sizeof(uint32_t), cmp_lat);
+
+  #define PCTL(p) (n > 0 ? lat[(size_t)((n-1) * (p))] : 0)
+  printf("%-20s %-10s %9zu %8.2f %7u %7u %7u %7u %9u",
+         t->name, d->name, t->nops,
+         total.total_ns > 0 ? (double)n * 1000.0 / total.total_ns : 0.0,
+         PCTL(0.5), PCTL(0.9), PCTL(0.99), PCTL(0.999), PCTL(1.0));
+  #undef PCTL
+  if (total.peak_footprint > 0) {
+    printf(" %6.1f%% %6zd\n", 100.0 * total.peak_live / total.peak_footprint, total.nsbrk);
+  } else {
+    printf(" %7s %6s\n", "-", "-");
+  }
+
+  if (phases && (d->fp >= 0)) print_phases();
+
+  free(lat);
+}
+
+
+/// @brief write a random trace of (about) @a nops operations to stdout
+/// @param nops number of operations
+/// @param seed random seed
+static void generate(size_t nops, unsigned int seed)
+{
+  unsigned int *live = malloc((nops + 1) * sizeof(unsigned int));
+  size_t nlive = 0;
+  unsigned int next_id = 0;
+
+  if (live == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return;
+  }
+
+  srand(seed);
+  printf("# random trace, %zu operations, seed %u\n", nops, seed);
+
+  for (size_t i=0; i<nops; i++) {
+    int r = rand() % 100;
+    // sizes are log-uniformly distributed between 1 byte and 64 KB
+    size_t size = 1 + rand() % (1UL << (rand() % 17));
+
+    if ((nlive == 0) || (r < 50)) {
+      if (r < 5) printf("c %u %zu %zu\n", next_id, 1 + size / 16, (size_t)16);
+      else printf("a %u %zu\n", next_id, size);
+      live[nlive++] = next_id++;
+    } else if (r < 60) {
+      printf("r %u %zu\n", live[rand() % nlive], size);
+    } else {
+      size_t k = rand() % nlive;
+      printf("f %u\n", live[k]);
+      live[k] = live[--nlive];
+    }
+  }
+  while (nlive > 0) printf("f %u\n", live[--nlive]);
+
+  free(live);
+}
+
+
+/// @brief print usage and exit
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [options] trace...\n"
+          "       %s -g <nops> [-S <seed>]\n"
+          "\n"
+          "Options:\n"
+          "  -d <drivers>   drivers to run: i(mplicit) e(xplicit) s(egregated) t(ree)\n"
+          "                 a(ddress-ordered) (next) f(it) n(ull)\n"
+          "                 (default: iestafn)\n"
+          "  -r <n>         repeat every run n times (default: 1)\n"
+          "  -O <options>   options for mm_init_ex() (default: 0)\n"
+          "  -H <MB>        data segment size in MB (default: 256)\n"
+          "  -v             verify payload contents\n"
+          "  -l             print latencies of internal phases (requires MM_TIMING)\n"
+          "  -g <nops>      write a random trace with <nops> operations to stdout\n"
+          "  -S <seed>      random seed for -g (default: 1)\n",
+          prog, prog);
+  exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+  const char *sel = "iestafn";
+  size_t gen = 0;
+  unsigned int seed = 1;
+  int c;
+
+  while ((c = getopt(argc, argv, "d:r:O:H:vlg:S:")) != -1) {
+    switch (c) {
+      case 'd': sel = optarg; break;
+      case 'r': repeat = atoi(optarg); break;
+      case 'O': mm_options = strtol(optarg, NULL, 0); break;
+      case 'H': heap_size = strtoul(optarg, NULL, 0) << 20; break;
+      case 'v': verify = 1; break;
+      case 'l': phases = 1; break;
+      case 'g': gen = strtoul(optarg, NULL, 0); break;
+      case 'S': seed = strtoul(optarg, NULL, 0); break;
+      default:  usage(argv[0]);
+    }
+  }
+
+  if (gen > 0) {
+    generate(gen, seed);
+    return EXIT_SUCCESS;
+  }
+
+  if ((optind >= argc) || (repeat < 1) || (heap_size == 0)) usage(argv[0]);
+
+  ds_setloglevel(0);
+  mm_setloglevel(0);
+
+  printf("%-20s %-10s %9s %8s %7s %7s %7s %7s %9s %7s %6s\n",
+         "trace", "driver", "ops", "Mops/s", "p50", "p90", "p99", "p99.9", "max", "util", "nsbrk");
+  printf("%-20s %-10s %9s %8s %7s %7s %7s %7s %9s %7s %6s\n",
+         "", "", "", "", "(ns)", "(ns)", "(ns)", "(ns)", "(ns)", "", "");
+
+  int res = EXIT_SUCCESS;
+  for (int i=optind; i<argc; i++) {
+    Trace t;
+    if (load_trace(argv[i], &t) != 0) {
+      res = EXIT_FAILURE;
+      continue;
+    }
+
+    for (const char *s=sel; *s; s++) {
+      for (size_t d=0; d<NUM_DRIVERS; d++) {
+        if (drivers[d].key != *s) continue;
+        if (!supported(&drivers[d])) {
+          fprintf(stderr, "driver %s not supported by this build, skipped\n", drivers[d].name);
+          continue;
+        }
+        run(&drivers[d], &t);
+      }
+    }
+
+    free(t.ops);
+  }
+
+  return res;
+}
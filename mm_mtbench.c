@@ -0,0 +1,589 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Spring 2024
+//
+/// @file
+/// @brief multi-threaded stress and scalability benchmark for the dynamic memory manager
+/// @section changelog Change Log
+/// 2026/10/14 created
+///
+/// @section license_section License
+/// Copyright (c) 2020-2023, Computer Systems and Platforms Laboratory, SNU
+/// All rights reserved.
+///
+/// Redistribution and use in source and binary forms, with or without modification, are permitted
+/// provided that the following conditions are met:
+///
+/// - Redistributions of source code must retain the above copyright notice, this list of condi-
+///   tions and the following disclaimer.
+/// - Redistributions in binary form must reproduce the above copyright notice, this list of condi-
+///   tions and the following disclaimer in the documentation and/or other materials provided with
+///   the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+/// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE IMPLIED WARRANTIES OF MERCHANTABILITY
+/// AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+/// CONTRIBUTORS BE LIABLE FOR ANY DIRECT,  INDIRECT, INCIDENTAL,  SPECIAL,  EXEMPLARY,  OR CONSE-
+/// QUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+/// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)   HOWEVER CAUSED AND ON ANY THEORY OF
+/// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+/// DAMAGE.
+//--------------------------------------------------------------------------------------------------
+
+// Multi-threaded benchmark
+// ========================
+// mm_mtbench runs concurrent allocation workloads with 1, 2, 4, ... up to N threads against the
+// free list policies of the memory manager and against the system malloc as a baseline, and
+// reports throughput, speedup over one thread, and resident memory for every thread count.
+//
+// Workloads:
+// ----------
+// - local (l): every thread replaces random blocks of its own array of slots. All frees are
+//   thread-local; this is the best case for thread caches and arenas.
+// - larson (r): like local, but after every round (as many operations as slots) a thread swaps
+//   its slot array with a random one of a shared pool, so that most blocks end up being freed
+//   by another thread than the one that allocated them (after the larson server benchmark,
+//   which hands the slot arrays to newly created threads instead).
+// - xmalloc (x): half of the threads allocate batches of blocks and pass them through a shared
+//   bounded queue to the other half, which frees them (after xmalloc-test). All frees are remote.
+//   With a single thread, the thread frees its own batches.
+// Block sizes are uniformly distributed between -m and -M bytes. The first and last byte of
+// every block are written so that the memory is actually touched.
+//
+// Measurements:
+// -------------
+// - throughput: malloc and free calls of all threads during the measurement interval (-s)
+//   divided by its length. Setup (filling the slot arrays) and teardown are not included.
+// - RSS: peak resident set size of the process during the run minus that before the run,
+//   sampled every 10 ms from /proc/self/statm. The data segment of the memory manager is
+//   allocated lazily (DS_LAZY) so that only touched pages count; the system malloc may keep
+//   memory of earlier runs, which then does not show again.
+// - for the memory manager, every run starts with a fresh data segment partitioned into one
+//   sub-segment (arena) per thread (or -a) and a fresh heap.
+//
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dataseg.h"
+#include "memmgr.h"
+
+
+/// @brief memory manager driver
+typedef struct {
+  char key;                       ///< driver selection key (-d)
+  const char *name;               ///< name
+  int fp;                         ///< free list policy (-1: system malloc)
+  void* (*malloc)(size_t);
+  void  (*free)(void*);
+} Driver;
+
+static Driver drivers[] = {
+  { 'i', "implicit",   fp_Implicit,    mm_malloc, mm_free },
+  { 'e', "explicit",   fp_Explicit,    mm_malloc, mm_free },
+  { 's', "segregated", fp_Segregated,  mm_malloc, mm_free },
+  { 't', "tree",       fp_Tree,        mm_malloc, mm_free },
+  { 'a', "addrorder",  fp_AddrOrdered, mm_malloc, mm_free },
+  { 'f', "nextfit",    fp_NextFit,     mm_malloc, mm_free },
+  { 'c', "system",     -1,             malloc,    free    },
+};
+#define NUM_DRIVERS (sizeof(drivers) / sizeof(drivers[0]))
+
+/// @brief workload
+typedef struct {
+  char key;                       ///< workload selection key (-w)
+  const char *name;               ///< name
+  void* (*thread)(void*);         ///< thread function
+} Workload;
+
+/// @name options
+/// @{
+static size_t heap_size = 1024UL << 20;   ///< data segment size
+#ifdef MM_OPTIONS
+static int mm_options = MM_OPTIONS;       ///< options passed to mm_init_ex() (fixed by the build)
+#else
+static int mm_options = 0;                ///< options passed to mm_init_ex()
+#endif
+static int narenas = 0;                   ///< number of arenas (0: one per thread)
+static int tcache = -1;                   ///< thread cache capacity (-1: default)
+static double duration = 1.0;             ///< measurement interval in seconds
+static size_t min_size = 16;              ///< minimum block size
+static size_t max_size = 512;             ///< maximum block size
+static size_t nslots = 1000;              ///< slots per thread (local, larson)
+/// @}
+
+
+/// @brief check whether the memory manager supports driver @a d with the selected options
+///        (specialized builds, see MM_SUPPORTED())
+/// @param d driver
+/// @retval 1 if supported
+/// @retval 0 otherwise
+static int supported(const Driver *d)
+{
+  return (d->fp < 0) || MM_SUPPORTED(d->fp, mm_options);
+}
+
+/// @name batches passed from producers to consumers (xmalloc)
+/// @{
+#define BATCH   64                        ///< blocks per batch
+#define QUEUE   256                       ///< queue capacity in batches
+
+typedef struct {
+  void *ptr[BATCH];
+} Batch;
+/// @}
+
+/// @brief state shared by the threads of a run
+static struct {
+  const Driver *d;                ///< driver
+  int nthreads;                   ///< number of threads
+  pthread_barrier_t start;        ///< released when all threads are ready (and main)
+  int stop;                       ///< set by main at the end of the measurement interval
+
+  void ***pool;                   ///< slot arrays to swap with (larson)
+  pthread_mutex_t pool_lock;      ///< protects pool
+
+  Batch *queue[QUEUE];            ///< ring buffer of full batches (xmalloc)
+  size_t head, count;             ///< oldest entry, number of entries
+  int nproducers;                 ///< producers still running
+  pthread_mutex_t queue_lock;     ///< protects queue, head, count, nproducers
+  pthread_cond_t not_empty;       ///< signaled when a batch is added or a producer exits
+  pthread_cond_t not_full;        ///< signaled when a batch is removed
+} run_state;
+
+/// @brief per-thread state
+typedef struct {
+  pthread_t tid;                  ///< thread id
+  int idx;                        ///< thread index
+  uint64_t rand;                  ///< random number generator state
+  size_t ops;                     ///< malloc and free calls during the measurement interval
+  void **slots;                   ///< slot array (local, larson)
+  int error;                      ///< out of memory
+} Worker;
+
+
+/// @brief get current time in nanoseconds
+static inline uint64_t now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/// @brief get current resident set size in bytes
+static size_t rss(void)
+{
+  unsigned long size, resident = 0;
+
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f != NULL) {
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(f);
+  }
+
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+/// @brief get next random number of worker @a w (xorshift64)
+static inline uint64_t next_rand(Worker *w)
+{
+  w->rand ^= w->rand << 13;
+  w->rand ^= w->rand >> 7;
+  w->rand ^= w->rand << 17;
+  return w->rand;
+}
+
+/// @brief check whether the measurement interval has ended
+static inline int stopped(void)
+{
+  return __atomic_load_n(&run_state.stop, __ATOMIC_RELAXED);
+}
+
+/// @brief allocate a block of random size and touch it
+/// @retval void* the block, NULL if out of memory (w->error is set)
+static void* alloc_block(Worker *w)
+{
+  size_t size = min_size + next_rand(w) % (max_size - min_size + 1);
+  char *p = run_state.d->malloc(size);
+
+  if (p == NULL) {
+    w->error = 1;
+    return NULL;
+  }
+  p[0] = (char)w->idx;
+  p[size-1] = (char)w->idx;
+
+  return p;
+}
+
+/// @brief allocate and fill a slot array
+/// @retval void** the slot array, NULL if out of memory (w->error is set)
+static void** alloc_slots(Worker *w)
+{
+  void **slots = calloc(nslots, sizeof(void*));
+
+  if (slots == NULL) {
+    w->error = 1;
+    return NULL;
+  }
+  for (size_t i=0; (i<nslots) && !w->error; i++) slots[i] = alloc_block(w);
+
+  return slots;
+}
+
+/// @brief replace @a n random blocks of @a slots
+static void churn(Worker *w, void **slots, size_t n)
+{
+  for (size_t i=0; (i<n) && !w->error; i++) {
+    size_t k = next_rand(w) % nslots;
+    run_state.d->free(slots[k]);
+    slots[k] = alloc_block(w);
+  }
+  w->ops += 2*n;
+}
+
+
+/// @brief local workload: churn on a private slot array
+static void* local_thread(void *arg)
+{
+  Worker *w = arg;
+
+  w->slots = alloc_slots(w);
+  pthread_barrier_wait(&run_state.start);
+
+  while (!w->error && !stopped()) churn(w, w->slots, 64);
+
+  return NULL;
+}
+
+
+/// @brief larson workload: churn on a slot array and swap it with one of the pool every round
+static void* larson_thread(void *arg)
+{
+  Worker *w = arg;
+
+  w->slots = alloc_slots(w);
+  run_state.pool[w->idx] = alloc_slots(w);
+  pthread_barrier_wait(&run_state.start);
+
+  while (!w->error && !stopped()) {
+    churn(w, w->slots, nslots);
+
+    size_t k = next_rand(w) % run_state.nthreads;
+    pthread_mutex_lock(&run_state.pool_lock);
+    void **slots = run_state.pool[k];
+    run_state.pool[k] = w->slots;
+    pthread_mutex_unlock(&run_state.pool_lock);
+    w->slots = slots;
+  }
+
+  return NULL;
+}
+
+
+/// @brief add batch @a b to the queue; blocks while it is full
+static void queue_put(Batch *b)
+{
+  pthread_mutex_lock(&run_state.queue_lock);
+  while (run_state.count == QUEUE) pthread_cond_wait(&run_state.not_full, &run_state.queue_lock);
+  run_state.queue[(run_state.head + run_state.count++) % QUEUE] = b;
+  pthread_cond_signal(&run_state.not_empty);
+  pthread_mutex_unlock(&run_state.queue_lock);
+}
+
+/// @brief remove the oldest batch from the queue; blocks while it is empty and producers are
+///        running
+/// @retval Batch* the batch, NULL if the queue is empty and all producers have exited
+static Batch* queue_get(void)
+{
+  Batch *b = NULL;
+
+  pthread_mutex_lock(&run_state.queue_lock);
+  while ((run_state.count == 0) && (run_state.nproducers > 0)) {
+    pthread_cond_wait(&run_state.not_empty, &run_state.queue_lock);
+  }
+  if (run_state.count > 0) {
+    b = run_state.queue[run_state.head];
+    run_state.head = (run_state.head + 1) % QUEUE;
+    run_state.count--;
+    pthread_cond_signal(&run_state.not_full);
+  }
+  pthread_mutex_unlock(&run_state.queue_lock);
+
+  return b;
+}
+
+/// @brief fill batch @a b with new blocks
+static int produce(Worker *w, Batch *b)
+{
+  for (int i=0; i<BATCH; i++) {
+    if ((b->ptr[i] = alloc_block(w)) == NULL) {
+      while (--i >= 0) run_state.d->free(b->ptr[i]);
+      return -1;
+    }
+  }
+  w->ops += BATCH;
+
+  return 0;
+}
+
+/// @brief free the blocks of batch @a b and the batch itself
+static void consume(Worker *w, Batch *b)
+{
+  for (int i=0; i<BATCH; i++) run_state.d->free(b->ptr[i]);
+  if (!stopped()) w->ops += BATCH;
+  free(b);
+}
+
+/// @brief xmalloc workload: even threads produce batches, odd threads consume them
+static void* xmalloc_thread(void *arg)
+{
+  Worker *w = arg;
+  int producer = (w->idx % 2 == 0);
+  int alone = (run_state.nthreads == 1);
+
+  pthread_barrier_wait(&run_state.start);
+
+  if (producer) {
+    while (!w->error && !stopped()) {
+      Batch *b = malloc(sizeof(Batch));
+      if ((b == NULL) || (produce(w, b) != 0)) {
+        free(b);
+        w->error = 1;
+        break;
+      }
+      if (alone) consume(w, b);
+      else queue_put(b);
+    }
+
+    pthread_mutex_lock(&run_state.queue_lock);
+    run_state.nproducers--;
+    pthread_cond_broadcast(&run_state.not_empty);
+    pthread_mutex_unlock(&run_state.queue_lock);
+  } else {
+    Batch *b;
+    while ((b = queue_get()) != NULL) consume(w, b);
+  }
+
+  return NULL;
+}
+
+static const Workload workloads[] = {
+  { 'l', "local",   local_thread   },
+  { 'r', "larson",  larson_thread  },
+  { 'x', "xmalloc", xmalloc_thread },
+};
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+
+/// @brief run workload @a wl with @a nthreads threads against driver @a d
+/// @param[out] mops throughput in million operations per second
+/// @param[out] rss_peak peak RSS increase in bytes
+/// @retval 0 on success
+/// @retval -1 on error (an error message has been printed)
+static int run(const Workload *wl, const Driver *d, int nthreads, double *mops, size_t *rss_peak)
+{
+  int mm = d->fp >= 0;
+  int res = 0;
+
+  Worker *w = calloc(nthreads, sizeof(Worker));
+  void ***pool = calloc(nthreads, sizeof(void**));
+  if ((w == NULL) || (pool == NULL)) {
+    fprintf(stderr, "out of memory\n");
+    free(w);
+    free(pool);
+    return -1;
+  }
+
+  size_t rss_base = rss();
+
+  if (mm) {
+    ds_allocate_ex(heap_size, DS_LAZY);
+    int nseg = narenas > 0 ? narenas : nthreads;
+    if (ds_partition(nseg < DS_MAXSEG ? nseg : DS_MAXSEG) != 0) {
+      fprintf(stderr, "cannot partition data segment: %s\n", strerror(errno));
+      ds_release();
+      free(w);
+      free(pool);
+      return -1;
+    }
+    if (tcache >= 0) mm_settcache(tcache);
+    mm_init_ex(d->fp, mm_options);
+  }
+
+  run_state.d = d;
+  run_state.nthreads = nthreads;
+  run_state.stop = 0;
+  run_state.pool = pool;
+  run_state.head = run_state.count = 0;
+  run_state.nproducers = (nthreads + 1) / 2;
+  pthread_barrier_init(&run_state.start, NULL, nthreads + 1);
+  pthread_mutex_init(&run_state.pool_lock, NULL);
+  pthread_mutex_init(&run_state.queue_lock, NULL);
+  pthread_cond_init(&run_state.not_empty, NULL);
+  pthread_cond_init(&run_state.not_full, NULL);
+
+  for (int i=0; i<nthreads; i++) {
+    w[i].idx = i;
+    w[i].rand = 0x9e3779b97f4a7c15UL * (i + 1);
+    if (pthread_create(&w[i].tid, NULL, wl->thread, &w[i]) != 0) {
+      fprintf(stderr, "cannot create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // measurement interval; sample RSS meanwhile
+  pthread_barrier_wait(&run_state.start);
+  uint64_t start = now(), end = start + (uint64_t)(duration * 1e9), t;
+  size_t peak = rss();
+  while ((t = now()) < end) {
+    struct timespec ts = { 0, 10000000 };
+    if (end - t < 10000000) ts.tv_nsec = end - t;
+    nanosleep(&ts, NULL);
+
+    size_t r = rss();
+    if (r > peak) peak = r;
+  }
+  __atomic_store_n(&run_state.stop, 1, __ATOMIC_RELAXED);
+  uint64_t elapsed = now() - start;
+
+  size_t ops = 0;
+  for (int i=0; i<nthreads; i++) {
+    pthread_join(w[i].tid, NULL);
+    ops += w[i].ops;
+    if (w[i].error) res = -1;
+  }
+  if (res != 0) fprintf(stderr, "%s/%s/%d: out of memory\n", wl->name, d->name, nthreads);
+
+  // teardown. The data segment of the memory manager is simply discarded.
+  for (int i=0; i<nthreads; i++) {
+    void **slots[2] = { w[i].slots, pool[i] };
+    for (int k=0; k<2; k++) {
+      if ((slots[k] != NULL) && !mm) {
+        for (size_t j=0; j<nslots; j++) d->free(slots[k][j]);
+      }
+      free(slots[k]);
+    }
+  }
+  if (mm) ds_release();
+
+  pthread_cond_destroy(&run_state.not_full);
+  pthread_cond_destroy(&run_state.not_empty);
+  pthread_mutex_destroy(&run_state.queue_lock);
+  pthread_mutex_destroy(&run_state.pool_lock);
+  pthread_barrier_destroy(&run_state.start);
+  free(pool);
+  free(w);
+
+  *mops = elapsed > 0 ? (double)ops * 1000.0 / elapsed : 0.0;
+  *rss_peak = peak > rss_base ? peak - rss_base : 0;
+
+  return res;
+}
+
+
+/// @brief print usage and exit
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "\n"
+          "Options:\n"
+          "  -w <workloads> workloads to run: l(ocal) (la)r(son) x(malloc) (default: lrx)\n"
+          "  -d <drivers>   drivers to run: i(mplicit) e(xplicit) s(egregated) t(ree)\n"
+          "                 a(ddress-ordered) (next) f(it) c(system)\n"
+          "                 (default: stc)\n"
+          "  -t <n>         maximum number of threads; runs with 1, 2, 4, ..., n threads\n"
+          "                 (default: number of CPUs)\n"
+          "  -s <sec>       measurement interval per run in seconds (default: 1)\n"
+          "  -m <size>      minimum block size (default: 16)\n"
+          "  -M <size>      maximum block size (default: 512)\n"
+          "  -n <n>         slots per thread for local and larson (default: 1000)\n"
+          "  -a <n>         number of arenas (default: one per thread)\n"
+          "  -c <n>         thread cache capacity for mm_settcache() (default: unchanged)\n"
+          "  -O <options>   options for mm_init_ex() (default: 0)\n"
+          "  -H <MB>        data segment size in MB (default: 1024)\n",
+          prog);
+  exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+  const char *wsel = "lrx", *dsel = "stc";
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  int maxthreads = ncpu > 0 ? (int)ncpu : 1;
+  int c;
+
+  while ((c = getopt(argc, argv, "w:d:t:s:m:M:n:a:c:O:H:")) != -1) {
+    switch (c) {
+      case 'w': wsel = optarg; break;
+      case 'd': dsel = optarg; break;
+      case 't': maxthreads = atoi(optarg); break;
+      case 's': duration = atof(optarg); break;
+      case 'm': min_size = strtoul(optarg, NULL, 0); break;
+      case 'M': max_size = strtoul(optarg, NULL, 0); break;
+      case 'n': nslots = strtoul(optarg, NULL, 0); break;
+      case 'a': narenas = atoi(optarg); break;
+      case 'c': tcache = atoi(optarg); break;
+      case 'O': mm_options = strtol(optarg, NULL, 0); break;
+      case 'H': heap_size = strtoul(optarg, NULL, 0) << 20; break;
+      default:  usage(argv[0]);
+    }
+  }
+
+  if ((optind < argc) || (maxthreads < 1) || (duration <= 0.0) || (min_size == 0) ||
+      (max_size < min_size) || (nslots == 0) || (narenas < 0) || (heap_size == 0)) {
+    usage(argv[0]);
+  }
+
+  ds_setloglevel(0);
+  mm_setloglevel(0);
+
+  printf("%-10s %-10s %7s %8s %8s %9s\n",
+         "workload", "driver", "threads", "Mops/s", "speedup", "RSS (MB)");
+
+  int res = EXIT_SUCCESS;
+  for (const char *ws=wsel; *ws; ws++) {
+    for (size_t wi=0; wi<NUM_WORKLOADS; wi++) {
+      if (workloads[wi].key != *ws) continue;
+
+      for (const char *s=dsel; *s; s++) {
+        for (size_t di=0; di<NUM_DRIVERS; di++) {
+          if (drivers[di].key != *s) continue;
+          if (!supported(&drivers[di])) {
+            fprintf(stderr, "driver %s not supported by this build, skipped\n", drivers[di].name);
+            continue;
+          }
+
+          double base = 0.0;
+          for (int n=1; ; n = (2*n < maxthreads) ? 2*n : maxthreads) {
+            double mops;
+            size_t rss_peak;
+
+            if (run(&workloads[wi], &drivers[di], n, &mops, &rss_peak) != 0) {
+              res = EXIT_FAILURE;
+              break;
+            }
+            if (n == 1) base = mops;
+
+            printf("%-10s %-10s %7d %8.2f %7.2fx %9.1f\n",
+                   workloads[wi].name, drivers[di].name, n, mops,
+                   base > 0.0 ? mops / base : 0.0, rss_peak / 1048576.0);
+            fflush(stdout);
+
+            if (n == maxthreads) break;
+          }
+        }
+      }
+    }
+  }
+
+  return res;
+}
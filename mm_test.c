@@ -134,6 +134,10 @@ int main(int argc, char *argv[])
            "  Select freelist policy.\n"
            "(i) implicit list\n"
            "(e) explicit list\n"
+           "(s) segregated lists\n"
+           "(t) size-ordered tree\n"
+           "(a) address-ordered list\n"
+           "(f) address-ordered list, next fit\n"
            "(q) quit\n"
            "Your selection: ");
     fflush(stdout);
@@ -143,13 +147,17 @@ int main(int argc, char *argv[])
       switch (c) {
         case 'i': fp = fp_Implicit; break;
         case 'e': fp = fp_Explicit; break;
+        case 's': fp = fp_Segregated; break;
+        case 't': fp = fp_Tree; break;
+        case 'a': fp = fp_AddrOrdered; break;
+        case 'f': fp = fp_NextFit; break;
         case 'q': return EXIT_SUCCESS;
         default:  if (c > ' ') printf("Invalid selection.\n");
       }
     } else {
       printf("Error reading character.\n");
     }
-  } while (c != 'i' && c != 'e');
+  } while (c != 'i' && c != 'e' && c != 's' && c != 't' && c != 'a' && c != 'f');
 
   printf("\n\n\n----------------------------------------\n"
          "  Initializing heap...\n"
@@ -0,0 +1,175 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Spring 2024
+//
+/// @file
+/// @brief region allocator (bump allocation with O(1) reset on top of the memory manager)
+/// @section changelog Change Log
+/// 2026/10/14 created
+///
+/// @section license_section License
+/// Copyright (c) 2020-2023, Computer Systems and Platforms Laboratory, SNU
+/// All rights reserved.
+///
+/// Redistribution and use in source and binary forms, with or without modification, are permitted
+/// provided that the following conditions are met:
+///
+/// - Redistributions of source code must retain the above copyright notice, this list of condi-
+///   tions and the following disclaimer.
+/// - Redistributions in binary form must reproduce the above copyright notice, this list of condi-
+///   tions and the following disclaimer in the documentation and/or other materials provided with
+///   the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+/// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE IMPLIED WARRANTIES OF MERCHANTABILITY
+/// AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+/// CONTRIBUTORS BE LIABLE FOR ANY DIRECT,  INDIRECT, INCIDENTAL,  SPECIAL,  EXEMPLARY,  OR CONSE-
+/// QUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+/// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)   HOWEVER CAUSED AND ON ANY THEORY OF
+/// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+/// DAMAGE.
+//--------------------------------------------------------------------------------------------------
+
+// Region allocator
+// ================
+// A region hands out memory by bumping a pointer through a list of chunks obtained with
+// mm_malloc(). Individual allocations are never freed; mm_region_reset() releases all of them at
+// once by rewinding to the first chunk, and mm_region_destroy() frees the chunks.
+//
+//    first                            cur
+//      |                               |
+//      v                               v
+//    +---+---+----------------+      +---+---+---------+-----------+      +---+---+--------+
+//    | n | s | allocated      | ---> | n | s | alloc.  |           | ---> | n | s |        |
+//    +---+---+----------------+      +---+---+---------+-----------+      +---+---+--------+
+//                                                      ^           ^
+//                                                     top        limit
+//
+// - n: next chunk; s: size of chunk (including the chunk header)
+// - chunks after cur are left over from before the last reset and are reused in order. Chunks
+//   too small for a request are skipped until the next reset.
+// - requests that do not fit into a chunk of the region's chunk size get a chunk of their own
+//
+
+#include <stdint.h>
+
+#include "memmgr.h"
+#include "region.h"
+
+
+/// @name Macro definitions
+/// @{
+#define MAX(a, b)          ((a) > (b) ? (a) : (b))     ///< MAX function
+
+#define REGION_CHUNKSIZE   (1<<16)                     ///< default chunk size
+#define REGION_ALIGN       16                          ///< alignment of allocations
+#define ALIGN_UP(p)        (((uintptr_t)(p) + REGION_ALIGN-1) & ~(uintptr_t)(REGION_ALIGN-1))
+                                                       ///< round address up to REGION_ALIGN
+/// @}
+
+
+/// @brief chunk header
+typedef struct Chunk {
+  struct Chunk *next;                                  ///< next chunk
+  size_t size;                                         ///< size of chunk (including header)
+} Chunk;
+
+/// @brief region
+struct MMRegion {
+  Chunk *first;                                        ///< first chunk
+  Chunk *cur;                                          ///< chunk allocations are served from
+  char *top;                                           ///< next free byte in cur
+  char *limit;                                         ///< end of cur
+  size_t chunksize;                                    ///< chunk allocation unit
+};
+
+
+/// @brief make chunk @a c the current chunk of region @a r
+/// @param r region
+/// @param c chunk
+static void region_use(MMRegion *r, Chunk *c)
+{
+  r->cur   = c;
+  r->top   = (char*)ALIGN_UP(c + 1);
+  r->limit = (char*)c + c->size;
+}
+
+
+/// @brief advance region @a r to a chunk with at least @a size free bytes. Left-over chunks are
+///        reused first; a new chunk is allocated if none of them is large enough.
+/// @param r region
+/// @param size size in bytes (multiple of REGION_ALIGN)
+/// @retval 1 on success
+/// @retval 0 if memory allocation failed
+static int region_refill(MMRegion *r, size_t size)
+{
+  Chunk *c = r->cur != NULL ? r->cur->next : r->first;
+
+  while (c != NULL) {
+    region_use(r, c);
+    if (size <= (size_t)(r->limit - r->top)) return 1;
+    c = c->next;
+  }
+
+  if (size > SIZE_MAX - sizeof(Chunk) - REGION_ALIGN) return 0;
+
+  size_t csize = MAX(r->chunksize, size + sizeof(Chunk) + REGION_ALIGN);
+  c = mm_malloc(csize);
+  if (c == NULL) return 0;
+
+  c->next = NULL;
+  c->size = csize;
+  if (r->cur != NULL) r->cur->next = c;
+  else r->first = c;
+
+  region_use(r, c);
+
+  return 1;
+}
+
+
+MMRegion* mm_region_create(size_t chunksize)
+{
+  MMRegion *r = mm_malloc(sizeof(MMRegion));
+  if (r == NULL) return NULL;
+
+  r->first = r->cur = NULL;
+  r->top = r->limit = NULL;
+  r->chunksize = chunksize > 0 ? chunksize : REGION_CHUNKSIZE;
+
+  return r;
+}
+
+
+void* mm_region_alloc(MMRegion *r, size_t size)
+{
+  if ((size == 0) || (size > SIZE_MAX - REGION_ALIGN)) return NULL;
+
+  size = ALIGN_UP(size);
+  if ((size > (size_t)(r->limit - r->top)) && !region_refill(r, size)) return NULL;
+
+  void *p = r->top;
+  r->top += size;
+
+  return p;
+}
+
+
+void mm_region_reset(MMRegion *r)
+{
+  if (r->first != NULL) region_use(r, r->first);
+}
+
+
+void mm_region_destroy(MMRegion *r)
+{
+  Chunk *c = r->first;
+
+  while (c != NULL) {
+    Chunk *next = c->next;
+    mm_free(c);
+    c = next;
+  }
+
+  mm_free(r);
+}
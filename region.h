@@ -0,0 +1,65 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Spring 2024
+//
+/// @file
+/// @brief region allocator (bump allocation with O(1) reset on top of the memory manager)
+/// @section changelog Change Log
+/// 2026/10/14 created
+///
+/// @section license_section License
+/// Copyright (c) 2020-2023, Computer Systems and Platforms Laboratory, SNU
+/// All rights reserved.
+///
+/// Redistribution and use in source and binary forms, with or without modification, are permitted
+/// provided that the following conditions are met:
+///
+/// - Redistributions of source code must retain the above copyright notice, this list of condi-
+///   tions and the following disclaimer.
+/// - Redistributions in binary form must reproduce the above copyright notice, this list of condi-
+///   tions and the following disclaimer in the documentation and/or other materials provided with
+///   the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+/// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE IMPLIED WARRANTIES OF MERCHANTABILITY
+/// AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+/// CONTRIBUTORS BE LIABLE FOR ANY DIRECT,  INDIRECT, INCIDENTAL,  SPECIAL,  EXEMPLARY,  OR CONSE-
+/// QUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+/// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)   HOWEVER CAUSED AND ON ANY THEORY OF
+/// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+/// DAMAGE.
+//--------------------------------------------------------------------------------------------------
+
+#ifndef __REGION_H__
+#define __REGION_H__
+
+#include <stddef.h>
+
+/// @brief region. Opaque; use the mm_region_* functions to operate on regions.
+typedef struct MMRegion MMRegion;
+
+/// @brief create a region. Memory is obtained from mm_malloc() in chunks of @a chunksize bytes.
+///        Regions are not thread-safe; each region must be used by one thread at a time.
+/// @param chunksize chunk size in bytes (0: default chunk size)
+/// @retval MMRegion* new region
+/// @retval NULL if memory allocation failed
+MMRegion* mm_region_create(size_t chunksize);
+
+/// @brief allocate @a size bytes from region @a r. Memory is 16-byte aligned and cannot be freed
+///        individually.
+/// @param r region
+/// @param size requested size in bytes
+/// @retval void* pointer to first byte of memory on success
+/// @retval NULL if memory allocation failed
+void* mm_region_alloc(MMRegion *r, size_t size);
+
+/// @brief release all allocations of region @a r at once in O(1). The chunks of the region are
+///        kept and reused by subsequent allocations.
+/// @param r region
+void mm_region_reset(MMRegion *r);
+
+/// @brief destroy region @a r and return all its chunks to the memory manager
+/// @param r region
+void mm_region_destroy(MMRegion *r);
+
+#endif // __REGION_H__